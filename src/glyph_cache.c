@@ -0,0 +1,258 @@
+/* glyph_cache.c */
+#include <stdlib.h>
+#include <string.h>
+#include "glyph_cache.h"
+
+#define KERNING_INITIAL_CAPACITY 1024
+#define KERNING_MAX_DELTA 32
+#define ASCII_CHECK_BLOCK 4096
+
+static const GlyphMetrics empty_glyph = {0, 0, 0, 1};
+
+static const GlyphMetrics* lookup_glyph(GlyphCache* cache, Uint16 codepoint) {
+    GlyphMetrics* page = cache->pages[codepoint >> 8];
+    if (!page) {
+        page = calloc(256, sizeof(GlyphMetrics));
+        if (!page) return &empty_glyph;
+        cache->pages[codepoint >> 8] = page;
+    }
+
+    GlyphMetrics* glyph = &page[codepoint & 0xFF];
+    if (!glyph->loaded) {
+        int minx = 0, maxx = 0, advance = 0;
+        if (TTF_GlyphMetrics(cache->font, codepoint, &minx, &maxx, NULL, NULL, &advance) == 0) {
+            glyph->minx = (Sint16)minx;
+            glyph->maxx = (Sint16)maxx;
+            glyph->advance = (Sint16)advance;
+        }
+        glyph->loaded = 1;
+    }
+    return glyph;
+}
+
+// Same accumulation as TTF_SizeUNICODE, with an explicit kerning delta
+static void measure_add_glyph(TextMeasure* measure, const GlyphMetrics* glyph, int kerning) {
+    measure->x += kerning;
+    int z = measure->x + glyph->minx;
+    if (measure->minx > z) measure->minx = z;
+    z = measure->x + (glyph->advance > glyph->maxx ? glyph->advance : glyph->maxx);
+    if (measure->maxx < z) measure->maxx = z;
+    measure->x += glyph->advance;
+}
+
+// SDL_ttf has no public per pair kerning query, so derive the delta from
+// the rendered width of the pair and the metrics of both glyphs
+static int probe_kerning(GlyphCache* cache, Uint16 first, Uint16 second) {
+    Uint16 pair[3] = { first, second, 0 };
+    int width = 0;
+    if (TTF_SizeUNICODE(cache->font, pair, &width, NULL) != 0) return 0;
+
+    const GlyphMetrics* a = lookup_glyph(cache, first);
+    const GlyphMetrics* b = lookup_glyph(cache, second);
+    for (int i = 0; i <= KERNING_MAX_DELTA; i++) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            TextMeasure measure;
+            text_measure_reset(&measure);
+            measure_add_glyph(&measure, a, 0);
+            measure_add_glyph(&measure, b, sign * i);
+            if (text_measure_width(&measure) == width) return sign * i;
+        }
+    }
+    return 0;
+}
+
+static int grow_kerning_table(GlyphCache* cache) {
+    size_t capacity = cache->kerning_capacity ? cache->kerning_capacity * 2 : KERNING_INITIAL_CAPACITY;
+    KerningEntry* table = calloc(capacity, sizeof(KerningEntry));
+    if (!table) return 0;
+
+    for (size_t i = 0; i < cache->kerning_capacity; i++) {
+        if (!cache->kerning[i].pair) continue;
+        size_t slot = (cache->kerning[i].pair * 2654435761u) & (capacity - 1);
+        while (table[slot].pair) slot = (slot + 1) & (capacity - 1);
+        table[slot] = cache->kerning[i];
+    }
+    free(cache->kerning);
+    cache->kerning = table;
+    cache->kerning_capacity = capacity;
+    return 1;
+}
+
+static int lookup_kerning(GlyphCache* cache, Uint16 first, Uint16 second) {
+    Uint32 pair = ((Uint32)first << 16) | second;
+    if (cache->kerning_capacity) {
+        size_t slot = (pair * 2654435761u) & (cache->kerning_capacity - 1);
+        while (cache->kerning[slot].pair) {
+            if (cache->kerning[slot].pair == pair) return cache->kerning[slot].delta;
+            slot = (slot + 1) & (cache->kerning_capacity - 1);
+        }
+    }
+
+    int delta = probe_kerning(cache, first, second);
+    if ((cache->kerning_count + 1) * 2 > cache->kerning_capacity && !grow_kerning_table(cache)) {
+        return delta;
+    }
+    size_t slot = (pair * 2654435761u) & (cache->kerning_capacity - 1);
+    while (cache->kerning[slot].pair) slot = (slot + 1) & (cache->kerning_capacity - 1);
+    cache->kerning[slot].pair = pair;
+    cache->kerning[slot].delta = delta;
+    cache->kerning_count++;
+    return delta;
+}
+
+// Fonts without a kerning table would only pay for pair probes,
+// check a few classic pairs to find out if kerning applies at all
+static int font_has_kerning(GlyphCache* cache) {
+    static const char* pairs[] = { "AV", "AW", "To", "Te", "LT", "Yo", "WA", "P." };
+    if (!TTF_GetFontKerning(cache->font)) return 0;
+
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        if (probe_kerning(cache, (Uint8)pairs[i][0], (Uint8)pairs[i][1]) != 0) return 1;
+    }
+    return 0;
+}
+
+// In a fixed pitch font most ASCII glyphs advance by the same amount and
+// do not reach outside of it, their widths then simply add up
+static void find_cell_glyphs(GlyphCache* cache) {
+    if (cache->use_kerning || !TTF_FontFaceIsFixedWidth(cache->font)) return;
+
+    int advance = lookup_glyph(cache, 'M')->advance;
+    if (advance <= 0) return;
+    for (Uint16 c = ' '; c < 127; c++) {
+        const GlyphMetrics* glyph = lookup_glyph(cache, c);
+        cache->cell_glyph[c] = glyph->advance == advance && glyph->minx >= 0 && glyph->maxx <= advance;
+    }
+    cache->cell_advance = advance;
+}
+
+GlyphCache* glyph_cache_create(TTF_Font* font, int font_size) {
+    if (!font) return NULL;
+    GlyphCache* cache = calloc(1, sizeof(GlyphCache));
+    if (!cache) return NULL;
+
+    cache->font = font;
+    cache->font_size = font_size;
+    for (Uint16 c = 0; c < 128; c++) {
+        cache->ascii[c] = *lookup_glyph(cache, c);
+    }
+    cache->use_kerning = font_has_kerning(cache);
+    find_cell_glyphs(cache);
+    return cache;
+}
+
+void glyph_cache_destroy(GlyphCache* cache) {
+    if (!cache) return;
+    for (int i = 0; i < 256; i++) {
+        free(cache->pages[i]);
+    }
+    free(cache->kerning);
+    free(cache);
+}
+
+size_t utf8_decode(const char* text, size_t length, Uint16* codepoint) {
+    const unsigned char* s = (const unsigned char*)text;
+    if (length == 0) {
+        *codepoint = 0;
+        return 0;
+    }
+
+    // Mirrors UTF8_to_UNICODE in SDL_ttf: no validation and 4 byte
+    // sequences truncated to 16 bits, so measured widths match rendering
+    Uint16 c = s[0];
+    size_t used = 1;
+    if (c >= 0xF0 && length >= 4) {
+        c = (Uint16)(((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F));
+        used = 4;
+    } else if (c >= 0xE0 && c < 0xF0 && length >= 3) {
+        c = (Uint16)(((s[0] & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F));
+        used = 3;
+    } else if (c >= 0xC0 && c < 0xE0 && length >= 2) {
+        c = (Uint16)(((s[0] & 0x1F) << 6) | (s[1] & 0x3F));
+        used = 2;
+    }
+    *codepoint = c;
+    return used;
+}
+
+size_t utf8_decode32(const char* text, size_t length, Uint32* codepoint) {
+    const unsigned char* s = (const unsigned char*)text;
+    if (length > 0 && s[0] >= 0xF0 && length >= 4) {
+        *codepoint = ((Uint32)(s[0] & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+        return 4;
+    }
+    Uint16 c;
+    size_t used = utf8_decode(text, length, &c);
+    *codepoint = c;
+    return used;
+}
+
+// UTF-8 character length detection
+int utf8_char_length(const char* str) {
+    unsigned char first_byte = (unsigned char)str[0];
+    
+    if (first_byte < 0x80) return 1;  // ASCII character
+    if (first_byte >= 0xC0 && first_byte <= 0xDF) return 2;  // 2-byte sequence
+    if (first_byte >= 0xE0 && first_byte <= 0xEF) return 3;  // 3-byte sequence
+    if (first_byte >= 0xF0 && first_byte <= 0xF7) return 4;  // 4-byte sequence
+    
+    return 1;  // Fallback
+}
+
+int is_ascii_text(const char* text, size_t length) {
+    // The bytes of a block are or-ed a word at a time, which compilers
+    // vectorize, and the high bits only looked at once per block
+    size_t pos = 0;
+    while (pos < length) {
+        size_t end = length - pos < ASCII_CHECK_BLOCK ? length : pos + ASCII_CHECK_BLOCK;
+        Uint64 high = 0;
+        for (; pos + 8 <= end; pos += 8) {
+            Uint64 word;
+            memcpy(&word, text + pos, 8);
+            high |= word;
+        }
+        for (; pos < end; pos++) high |= (unsigned char)text[pos];
+        if (high & 0x8080808080808080ull) return 0;
+    }
+    return 1;
+}
+
+void text_measure_reset(TextMeasure* measure) {
+    measure->x = 0;
+    measure->minx = 0;
+    measure->maxx = 0;
+    measure->prev = 0;
+}
+
+void text_measure_add(GlyphCache* cache, TextMeasure* measure, Uint16 codepoint) {
+    // SDL_ttf skips byte order marks without touching the kerning state
+    if (codepoint == 0xFEFF || codepoint == 0xFFFE) return;
+
+    int kerning = 0;
+    if (cache->use_kerning && measure->prev) {
+        kerning = lookup_kerning(cache, measure->prev, codepoint);
+    }
+    measure_add_glyph(measure, lookup_glyph(cache, codepoint), kerning);
+    measure->prev = codepoint;
+}
+
+void text_measure_add_ascii(GlyphCache* cache, TextMeasure* measure, unsigned char c) {
+    int kerning = 0;
+    if (cache->use_kerning && measure->prev) {
+        kerning = lookup_kerning(cache, measure->prev, c);
+    }
+    measure_add_glyph(measure, &cache->ascii[c], kerning);
+    measure->prev = c;
+}
+
+int text_measure_width(const TextMeasure* measure) {
+    return measure->maxx - measure->minx;
+}
+
+void text_measure_add_cells(GlyphCache* cache, TextMeasure* measure, size_t count, Uint16 last) {
+    if (count == 0) return;
+    // x never goes below 0 without kerning, so only the right edge moves
+    measure->x += (int)count * cache->cell_advance;
+    if (measure->maxx < measure->x) measure->maxx = measure->x;
+    measure->prev = last;
+}
@@ -0,0 +1,82 @@
+/* glyph_cache.h */
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <stddef.h>
+#include <SDL/SDL_ttf.h>
+
+/* Metrics of a single glyph as TTF_GlyphMetrics reports them */
+typedef struct {
+    Sint16 minx;
+    Sint16 maxx;
+    Sint16 advance;
+    Sint16 loaded;
+} GlyphMetrics;
+
+typedef struct {
+    Uint32 pair;      /* (first << 16) | second, 0 marks an empty slot */
+    int delta;        /* horizontal kerning adjustment in pixels */
+} KerningEntry;
+
+/* Advance and kerning tables for one (font, size) pair.
+ * Glyphs are stored in 256 pages of 256 codepoints which are
+ * allocated the first time a codepoint of that page is measured.
+ * For fixed pitch fonts without kerning, ASCII glyphs that stay inside
+ * their cell are flagged in cell_glyph, a run of them is as wide as
+ * cell_advance times its length. The metrics of the ASCII glyphs are
+ * loaded when the cache is created, for text_measure_add_ascii.
+ */
+typedef struct {
+    TTF_Font* font;
+    int font_size;
+    int use_kerning;
+    int cell_advance;             /* 0 unless the font is fixed pitch */
+    Uint8 cell_glyph[128];
+    GlyphMetrics ascii[128];
+    GlyphMetrics* pages[256];
+    KerningEntry* kerning;
+    size_t kerning_capacity;
+    size_t kerning_count;
+} GlyphCache;
+
+/* Running bounding box of a line, accumulated exactly like TTF_SizeUTF8 */
+typedef struct {
+    int x;
+    int minx;
+    int maxx;
+    Uint16 prev;
+} TextMeasure;
+
+/* Create a cache for an opened font, returns NULL on error */
+GlyphCache* glyph_cache_create(TTF_Font* font, int font_size);
+void glyph_cache_destroy(GlyphCache* cache);
+
+/* Decode one character the way SDL_ttf converts UTF-8 to UCS-2.
+ * Returns the number of bytes consumed (at least 1 when length > 0)
+ */
+size_t utf8_decode(const char* text, size_t length, Uint16* codepoint);
+
+/* Decode one character to its full code point, for classifying it.
+ * Returns the number of bytes consumed like utf8_decode
+ */
+size_t utf8_decode32(const char* text, size_t length, Uint32* codepoint);
+
+/* Length of the UTF-8 sequence starting at str, from its lead byte */
+int utf8_char_length(const char* str);
+
+/* Whether every byte of the text is 7-bit ASCII, so each byte is a
+ * character, a code point and a grapheme cluster of its own
+ */
+int is_ascii_text(const char* text, size_t length);
+
+void text_measure_reset(TextMeasure* measure);
+void text_measure_add(GlyphCache* cache, TextMeasure* measure, Uint16 codepoint);
+int text_measure_width(const TextMeasure* measure);
+
+/* text_measure_add for a byte below 128 of an ASCII text */
+void text_measure_add_ascii(GlyphCache* cache, TextMeasure* measure, unsigned char c);
+
+/* Add count cell glyphs ending with last, see cell_glyph */
+void text_measure_add_cells(GlyphCache* cache, TextMeasure* measure, size_t count, Uint16 last);
+
+#endif
@@ -0,0 +1,1338 @@
+/* layout.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "layout.h"
+#include "layout_cache.h"
+#include "line_break.h"
+
+#define LAYOUT_STOPPED ((size_t)-1)
+#define PARAGRAPH_SCAN_BYTES (16 * 1024)
+// Lines the prefix grows by between budget checks, enough for any paragraph the memo keeps
+#define PREFIX_CHUNK_LINES MEMO_MAX_LINES
+
+// Receives each display line produced by layout_paragraph, returns 0 to stop
+typedef int (*LineSink)(void* user, size_t start, size_t length, int is_wrapped);
+
+typedef struct {
+    TextLayout* layout;
+    const LayoutSource* source;
+} PrefixSink;
+
+typedef struct {
+    LineInfo* lines;
+    int count;
+    size_t stop_offset;
+} ChunkSink;
+
+// Looks for a line of a sparse layout, laying out from a checkpoint
+typedef struct {
+    int index;                   // Lines to pass, or -1 to look for offset
+    size_t offset;
+    int count;                   // Lines seen so far
+    LineInfo line;               // The last one of them
+} LineSeek;
+
+// Lines of a paragraph on their way to the memo
+typedef struct {
+    LineSink sink;
+    void* user;
+    size_t base;                 // Paragraph start
+    int count;
+    Uint32 lines[2 * MEMO_MAX_LINES];
+} MemoRecorder;
+
+// How far layout_paragraph has looked for the end of the paragraph
+typedef struct {
+    size_t end;                  // Paragraph break, or where scanning stopped
+    int found;                   // end is the end of the paragraph
+    int width;                   // Of the last line, when it ended the paragraph
+} ParagraphScan;
+
+// Prefix as published by whoever extends it, loaded in reverse publication
+// order so lines always cover everything before offset
+typedef struct {
+    int complete;
+    size_t offset;
+    int lines;
+} PrefixState;
+
+static void load_prefix(TextLayout* layout, PrefixState* state) {
+    state->complete = __atomic_load_n(&layout->complete, __ATOMIC_ACQUIRE);
+    state->offset = __atomic_load_n(&layout->next_offset, __ATOMIC_ACQUIRE);
+    state->lines = __atomic_load_n(&layout->total_lines, __ATOMIC_ACQUIRE);
+}
+
+// Function to start timing
+void start_timing(LayoutStats* stats) {
+    gettimeofday(&stats->start_time, NULL);
+    stats->memory_used = 0;
+    stats->total_blocks = 0;
+}
+
+// Function to end timing
+void end_timing(LayoutStats* stats) {
+    gettimeofday(&stats->end_time, NULL);
+}
+
+// Function to get elapsed milliseconds
+long get_elapsed_ms(LayoutStats* stats) {
+    long seconds = stats->end_time.tv_sec - stats->start_time.tv_sec;
+    long microseconds = stats->end_time.tv_usec - stats->start_time.tv_usec;
+    return seconds * 1000 + microseconds / 1000;
+}
+
+size_t layout_block_size(size_t text_length) {
+    size_t estimated_lines = text_length / ESTIMATED_LINE_BYTES;
+    size_t block_size = DEFAULT_BLOCKSIZE;
+    while (block_size < MAX_BLOCKSIZE && block_size * TARGET_BLOCK_COUNT < estimated_lines) {
+        block_size *= 2;
+    }
+    return block_size;
+}
+
+// Corrected initialization
+void init_text_layout(TextLayout* layout, size_t block_size) {
+    memset(layout, 0, sizeof(TextLayout));
+
+    // Round up to a power of two so a line is found with a shift and a mask
+    layout->block_size = 1;
+    while (layout->block_size < block_size) {
+        layout->block_size *= 2;
+        layout->block_shift++;
+    }
+
+    size_t alloc_size = sizeof(LineDirectory) + INITIAL_DIRECTORY_SIZE * sizeof(LineRecord*);
+    layout->directory = calloc(1, alloc_size);
+    if (layout->directory) {
+        layout->directory->capacity = INITIAL_DIRECTORY_SIZE;
+        layout->stats.block_size = layout->block_size;
+        layout->stats.memory_used = alloc_size;
+        layout->stats.total_blocks = 0;
+    }
+}
+
+// Next free block of the arena, the chunks of an earlier layout first
+static LineRecord* arena_alloc_block(TextLayout* layout) {
+    LayoutArena* arena = &layout->arena;
+    size_t count = layout->block_size;
+    while (arena->current && arena->current->capacity - arena->current->used < count) {
+        arena->current = arena->current->next;
+        if (arena->current) arena->current->used = 0;
+    }
+
+    if (!arena->current) {
+        // Twice the size of the last chunk
+        LayoutArenaChunk* last = arena->first;
+        while (last && last->next) last = last->next;
+        size_t blocks = last ? 2 * (last->capacity / count) : 1;
+        if (blocks < 1) blocks = 1;
+        if (blocks > ARENA_MAX_CHUNK_BLOCKS) blocks = ARENA_MAX_CHUNK_BLOCKS;
+
+        size_t alloc_size = sizeof(LayoutArenaChunk) + blocks * count * sizeof(LineRecord);
+        LayoutArenaChunk* chunk = malloc(alloc_size);
+        if (!chunk) return NULL;
+        chunk->next = NULL;
+        chunk->capacity = blocks * count;
+        chunk->used = 0;
+        if (last) last->next = chunk;
+        else arena->first = chunk;
+        arena->current = chunk;
+        arena->reserved += alloc_size;
+        layout->stats.memory_used += alloc_size;
+    }
+
+    LineRecord* block = arena->current->records + arena->current->used;
+    arena->current->used += count;
+    return block;
+}
+
+// Make sure record index has a block to go in
+static int ensure_record_capacity(TextLayout* layout, int index) {
+    int block_index = index >> layout->block_shift;
+    if (block_index < layout->stats.total_blocks) return 1;
+
+    LineDirectory* directory = layout->directory;
+    if (block_index >= directory->capacity) {
+        // Grow the directory, the old one stays valid for readers
+        int capacity = directory->capacity * 2;
+        size_t alloc_size = sizeof(LineDirectory) + capacity * sizeof(LineRecord*);
+        LineDirectory* grown = calloc(1, alloc_size);
+        if (!grown) return 0;
+        grown->previous = directory;
+        grown->capacity = capacity;
+        memcpy(grown->blocks, directory->blocks, directory->capacity * sizeof(LineRecord*));
+        __atomic_store_n(&layout->directory, grown, __ATOMIC_RELEASE);
+        layout->stats.memory_used += alloc_size;
+        directory = grown;
+    }
+
+    LineRecord* block = arena_alloc_block(layout);
+    if (!block) return 0;
+    directory->blocks[block_index] = block;
+    layout->stats.total_blocks++;
+    return 1;
+}
+
+// Make sure the line after the last one has a block to go in
+int ensure_layout_capacity(TextLayout* layout) {
+    return ensure_record_capacity(layout, layout->total_lines);
+}
+
+static LineRecord* record_slot(TextLayout* layout, int index) {
+    return &layout->directory->blocks[index >> layout->block_shift][index & (layout->block_size - 1)];
+}
+
+// Record of a published line. The directory is loaded after total_lines,
+// so it holds the block of index
+static LineRecord line_record(TextLayout* layout, int index) {
+    LineDirectory* directory = __atomic_load_n(&layout->directory, __ATOMIC_ACQUIRE);
+    return directory->blocks[index >> layout->block_shift][index & (layout->block_size - 1)];
+}
+
+static int is_break_char(char c) {
+    return c == '\n' || c == '\r';
+}
+
+int is_paragraph_break(const LayoutSource* source, size_t offset) {
+    const char* text = source->text;
+    if (offset >= source->length || !is_break_char(text[offset])) return 0;
+    if (!source->ignore_linebreaks) return 1;
+    return (offset > 0 && is_break_char(text[offset - 1])) ||
+        (offset + 1 < source->length && is_break_char(text[offset + 1]));
+}
+
+void copy_source_text(const LayoutSource* source, size_t start, size_t length, char* buffer) {
+    memcpy(buffer, source->text + start, length);
+    if (!source->ignore_linebreaks) return;
+    // Breaks inside a line always join
+    for (size_t i = 0; i < length; i++) {
+        if (is_break_char(buffer[i])) buffer[i] = ' ';
+    }
+}
+
+// Where a line ends, from where the line after it starts
+static size_t line_end_before(const LayoutSource* source, size_t start, size_t next_start, int is_wrapped) {
+    const char* text = source->text;
+    size_t end = next_start;
+    if (is_wrapped) {
+        // Drop the whitespace skipped after the wrap, and the break when
+        // the skipping ran to the end of the paragraph
+        while (end > start && (text[end - 1] == ' ' || text[end - 1] == '\t' || is_break_char(text[end - 1]))) end--;
+    } else if (end > start && is_paragraph_break(source, end - 1)) {
+        // Drop the line break, a CR LF pair counts as one
+        if (!source->ignore_linebreaks && text[end - 1] == '\n' && end - 1 > start && text[end - 2] == '\r') end -= 2;
+        else end--;
+    }
+    return end;
+}
+
+// Unpack a prefix line. Returns 0 when where it ends is not known yet,
+// the last published line may be part of a paragraph still being laid out
+static int decode_line(TextLayout* layout, const LayoutSource* source, const PrefixState* prefix, int index, LineInfo* line) {
+    LineRecord record = line_record(layout, index);
+    size_t start = (size_t)(record >> 1);
+    size_t next_start;
+    if (index + 1 < prefix->lines) {
+        next_start = (size_t)(line_record(layout, index + 1) >> 1);
+    } else if (start < prefix->offset) {
+        next_start = prefix->offset;
+    } else {
+        return 0;
+    }
+
+    line->line_start_offset = start;
+    line->is_wrapped = (int)(record & 1);
+    line->line_length = line_end_before(source, start, next_start, line->is_wrapped) - start;
+    return 1;
+}
+
+// Add a checkpoint to a sparse layout. Its two records share a block,
+// blocks hold an even number of records
+static int add_checkpoint(TextLayout* layout, size_t offset, int line) {
+    int index = 2 * layout->checkpoint_count;
+    if (!ensure_record_capacity(layout, index)) return 0;
+    LineRecord* records = record_slot(layout, index);
+    records[0] = offset;
+    records[1] = (LineRecord)line;
+    __atomic_store_n(&layout->checkpoint_count, layout->checkpoint_count + 1, __ATOMIC_RELEASE);
+    layout->checkpoint_paragraphs = 0;
+    return 1;
+}
+
+// Count a paragraph of a sparse layout, next is where the paragraph after it
+// starts. A checkpoint that cannot be added is tried again after the next one
+static void count_paragraph(TextLayout* layout, size_t next) {
+    layout->checkpoint_paragraphs++;
+    int last_line = (int)*record_slot(layout, 2 * layout->checkpoint_count - 1);
+    if (layout->checkpoint_paragraphs >= SPARSE_CHECKPOINT_PARAGRAPHS ||
+        layout->total_lines - last_line >= SPARSE_CHECKPOINT_LINES) {
+        add_checkpoint(layout, next, layout->total_lines);
+    }
+}
+
+// Last published checkpoint at or before the line index, or the offset
+// with by_offset set. -1 when there is none
+static int find_checkpoint(TextLayout* layout, size_t value, int by_offset) {
+    int left = 0;
+    int right = __atomic_load_n(&layout->checkpoint_count, __ATOMIC_ACQUIRE) - 1;
+    int found = -1;
+
+    while (left <= right) {
+        int mid = left + (right - left) / 2;
+        if ((size_t)line_record(layout, 2 * mid + (by_offset ? 0 : 1)) <= value) {
+            found = mid;
+            left = mid + 1;
+        } else {
+            right = mid - 1;
+        }
+    }
+    return found;
+}
+
+static int seek_line(void* user, size_t start, size_t length, int is_wrapped) {
+    LineSeek* seek = user;
+    if (seek->index < 0 && start > seek->offset) return 0;
+
+    seek->line.line_start_offset = start;
+    seek->line.line_length = length;
+    seek->line.is_wrapped = is_wrapped;
+    seek->count++;
+    // Stop right after the line asked for
+    return seek->index < 0 || seek->count <= seek->index;
+}
+
+static size_t layout_paragraph(const LayoutSource* source, size_t offset, int max_lines, LineSink sink, void* user);
+
+// Lay out from checkpoint until the seek stops
+static void seek_from_checkpoint(TextLayout* layout, const LayoutSource* source, int checkpoint, LineSeek* seek) {
+    size_t offset = (size_t)line_record(layout, 2 * checkpoint);
+    while (offset < source->length) {
+        offset = layout_paragraph(source, offset, 0, seek_line, seek);
+        if (offset == LAYOUT_STOPPED) break;
+    }
+}
+
+// Helper function to get a line from the layout
+int get_line_from_layout(TextLayout* layout, const LayoutSource* source, int index, LineInfo* line) {
+    PrefixState prefix;
+    load_prefix(layout, &prefix);
+    if (index < 0 || index >= prefix.lines) return 0;
+    if (!layout->sparse) return decode_line(layout, source, &prefix, index, line);
+
+    int checkpoint = find_checkpoint(layout, (size_t)index, 0);
+    if (checkpoint < 0) return 0;
+    LineSeek seek = { index - (int)line_record(layout, 2 * checkpoint + 1), 0, 0, { 0, 0, 0 } };
+    seek_from_checkpoint(layout, source, checkpoint, &seek);
+    if (seek.count != seek.index + 1) return 0;
+    *line = seek.line;
+    return 1;
+}
+
+// Everything but the arena
+static void release_text_layout(TextLayout* layout) {
+    stop_layout_worker(layout);
+    LineDirectory* directory = layout->directory;
+    while (directory) {
+        LineDirectory* previous = directory->previous;
+        free(directory);
+        directory = previous;
+    }
+    release_layout_cache(layout);
+    free(layout->window.lines);
+}
+
+// Clean up function
+void free_text_layout(TextLayout* layout) {
+    release_text_layout(layout);
+    LayoutArenaChunk* chunk = layout->arena.first;
+    while (chunk) {
+        LayoutArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    memset(layout, 0, sizeof(TextLayout));
+}
+
+void reset_text_layout(TextLayout* layout, size_t block_size) {
+    release_text_layout(layout);
+    LayoutArena arena = layout->arena;
+    init_text_layout(layout, block_size);
+
+    // Start carving from the first chunk again
+    arena.current = arena.first;
+    if (arena.current) arena.current->used = 0;
+    layout->arena = arena;
+    layout->stats.memory_used += (long)arena.reserved;
+}
+
+// Find how many bytes of text fit in max_width, preferring to break at the
+// last space or the last break between CJK characters. Widths are
+// accumulated from the glyph cache in a single pass, with fixed pitch
+// fonts runs of ASCII are only counted. When all of it fits its width
+// is stored in width, if given.
+static size_t fit_text_length(GlyphCache* glyphs, const char* text, size_t max_length, int max_width, int* width) {
+    if (!glyphs || !text || max_length == 0) return 0;
+
+    TextMeasure measure;
+    text_measure_reset(&measure);
+    GraphemeState graphemes;
+    grapheme_state_reset(&graphemes);
+    size_t last_break = 0;
+    size_t cluster = 0;          // Where the grapheme cluster of pos starts
+    Uint32 prev = 0;
+    size_t pos = 0;
+
+    while (pos < max_length) {
+        if (glyphs->cell_advance > 0 && measure.x >= 0) {
+            // Fixed pitch: count the cell glyphs that still fit without measuring them
+            int room = (max_width + measure.minx - measure.x) / glyphs->cell_advance;
+            size_t run_end = room > 0 && (size_t)room < max_length - pos ? pos + room : max_length;
+            if (room <= 0) run_end = pos;
+            size_t run_start = pos;
+            while (pos < run_end) {
+                unsigned char c = (unsigned char)text[pos];
+                if (is_break_char(c)) c = ' ';
+                if (c >= 128 || !glyphs->cell_glyph[c]) break;
+                if (pos > 0 && (c == ' ' || (pos == run_start && can_break_between(prev, c)))) {
+                    last_break = pos;
+                }
+                pos++;
+            }
+            if (pos > run_start) {
+                Uint16 last = is_break_char(text[pos - 1]) ? ' ' : (unsigned char)text[pos - 1];
+                text_measure_add_cells(glyphs, &measure, pos - run_start, last);
+                // Every ASCII character is a cluster of its own
+                grapheme_boundary(&graphemes, last);
+                cluster = pos - 1;
+                prev = last;
+            }
+            if (pos >= max_length) break;
+        }
+
+        Uint16 codepoint = ' ';
+        size_t char_length = 1;
+        if (!is_break_char(text[pos])) {
+            char_length = utf8_decode(text + pos, max_length - pos, &codepoint);
+        }
+        // Breaks are found from the full code point, SDL_ttf measures a truncated one
+        Uint32 full = codepoint;
+        if ((unsigned char)text[pos] >= 0xF0) utf8_decode32(text + pos, max_length - pos, &full);
+        if (grapheme_boundary(&graphemes, full)) cluster = pos;
+        if (pos > 0 && (codepoint == ' ' || can_break_between(prev, full))) {
+            last_break = pos;
+        }
+        prev = full;
+
+        text_measure_add(glyphs, &measure, codepoint);
+        if (text_measure_width(&measure) > max_width) {
+            // Break at the last opportunity when there is one, else before
+            // the grapheme cluster of this character
+            return last_break > 0 ? last_break : cluster;
+        }
+        pos += char_length;
+    }
+
+    if (width) *width = text_measure_width(&measure);
+    return max_length;
+}
+
+// fit_text_length for ASCII text: every byte is a character of its own
+// and two ASCII characters never break without a space, so only spaces
+// are break opportunities and nothing is decoded
+static size_t fit_ascii_length(GlyphCache* glyphs, const char* text, size_t max_length, int max_width, int* width) {
+    if (!glyphs || !text || max_length == 0) return 0;
+
+    TextMeasure measure;
+    text_measure_reset(&measure);
+    size_t last_break = 0;
+    for (size_t pos = 0; pos < max_length; pos++) {
+        unsigned char c = (unsigned char)text[pos];
+        if (is_break_char(c)) c = ' ';
+        if (pos > 0 && c == ' ') last_break = pos;
+        text_measure_add_ascii(glyphs, &measure, c);
+        if (text_measure_width(&measure) > max_width) return last_break > 0 ? last_break : pos;
+    }
+
+    if (width) *width = text_measure_width(&measure);
+    return max_length;
+}
+
+// Fixed pitch fonts count runs of cells faster than the ASCII kernel measures them
+static size_t fit_line_length(const LayoutSource* source, const char* text, size_t max_length, int* width) {
+    if (source->ascii && source->glyphs && source->glyphs->cell_advance == 0) {
+        return fit_ascii_length(source->glyphs, text, max_length, source->max_width, width);
+    }
+    return fit_text_length(source->glyphs, text, max_length, source->max_width, width);
+}
+
+size_t find_fitting_text_length(GlyphCache* glyphs, const char* text, size_t max_length, int max_width) {
+    return fit_text_length(glyphs, text, max_length, max_width, NULL);
+}
+
+size_t find_text_offset_at(GlyphCache* glyphs, const char* text, size_t length, int x, int* start_x) {
+    TextMeasure measure;
+    text_measure_reset(&measure);
+    size_t pos = 0;
+
+    while (glyphs && pos < length) {
+        if (glyphs->cell_advance > 0 && measure.x >= 0) {
+            // Fixed pitch: skip the cells left of x without measuring them
+            size_t run_end = pos + (x > measure.x ? (size_t)((x - measure.x) / glyphs->cell_advance) : 0);
+            if (run_end > length) run_end = length;
+            size_t run_start = pos;
+            while (pos < run_end && (unsigned char)text[pos] < 128 && glyphs->cell_glyph[(unsigned char)text[pos]]) {
+                pos++;
+            }
+            if (pos > run_start) text_measure_add_cells(glyphs, &measure, pos - run_start, (unsigned char)text[pos - 1]);
+            if (pos >= length) break;
+        }
+
+        Uint16 codepoint;
+        size_t char_length = utf8_decode(text + pos, length - pos, &codepoint);
+        TextMeasure next = measure;
+        text_measure_add(glyphs, &next, codepoint);
+        if (next.x > x) break;
+        measure = next;
+        pos += char_length;
+    }
+
+    *start_x = measure.x;
+    return pos;
+}
+
+// Slot for the line after the last one, allocate new block if needed.
+// It is counted in total_lines once the caller filled it in.
+static LineRecord* add_line_to_layout(TextLayout* layout) {
+    if (!ensure_layout_capacity(layout)) return NULL;
+    return record_slot(layout, layout->total_lines);
+}
+
+static size_t paragraph_end(const LayoutSource* source, size_t offset) {
+    while (offset < source->length && !is_paragraph_break(source, offset)) {
+        offset++;
+    }
+    return offset;
+}
+
+// Look for the end of a paragraph PARAGRAPH_SCAN_BYTES further, so a huge
+// paragraph is only scanned as far as its lines are laid out
+static void scan_paragraph(const LayoutSource* source, ParagraphScan* scan) {
+    size_t limit = scan->end + PARAGRAPH_SCAN_BYTES;
+    if (limit > source->length || limit < scan->end) limit = source->length;
+    while (scan->end < limit && !is_paragraph_break(source, scan->end)) {
+        scan->end++;
+    }
+    scan->found = scan->end < limit || scan->end == source->length;
+
+    // Do not stop inside a character, it would be measured as another one
+    while (!scan->found && (source->text[scan->end] & 0xC0) == 0x80) {
+        scan->end++;
+        scan->found = scan->end == source->length;
+    }
+}
+
+// Offset after the line break at offset, a CR LF pair counts as one break
+// except in the ignore linebreaks view, where it is an empty line
+static size_t skip_line_break(const LayoutSource* source, size_t offset) {
+    if (offset >= source->length) return source->length;
+    if (!source->ignore_linebreaks && source->text[offset] == '\r' &&
+        offset + 1 < source->length && source->text[offset + 1] == '\n') {
+        return offset + 2;
+    }
+    return offset + 1;
+}
+
+static size_t find_paragraph_start(const LayoutSource* source, size_t offset) {
+    const char* text = source->text;
+    if (offset >= source->length) offset = source->length;
+    // The LF of a CR LF pair belongs to the break before it
+    if (!source->ignore_linebreaks && offset > 0 && offset < source->length &&
+        text[offset] == '\n' && text[offset - 1] == '\r') {
+        offset--;
+    }
+    while (offset > 0 && !is_paragraph_break(source, offset - 1)) {
+        offset--;
+    }
+    return offset;
+}
+
+// Lay out the lines from the line start at offset to the end of its paragraph,
+// or until max_lines lines were produced (0 means no limit).
+// Returns where the next line starts, or LAYOUT_STOPPED if the sink stopped.
+static size_t layout_lines(const LayoutSource* source, size_t offset, ParagraphScan* scan, int max_lines,
+    LineSink sink, void* user);
+
+// Keeps the lines of a paragraph for the memo while passing them on
+static int record_line(void* user, size_t start, size_t length, int is_wrapped) {
+    MemoRecorder* recorder = user;
+    if (recorder->count < MEMO_MAX_LINES) {
+        recorder->lines[2 * recorder->count] = (Uint32)(start - recorder->base);
+        recorder->lines[2 * recorder->count + 1] = (Uint32)(length << 1) | (is_wrapped ? 1 : 0);
+    }
+    recorder->count++;
+    return recorder->sink(recorder->user, start, length, is_wrapped);
+}
+
+static size_t layout_paragraph(const LayoutSource* source, size_t offset, int max_lines, LineSink sink, void* user) {
+    ParagraphScan scan = { offset, 0, 0 };
+    scan_paragraph(source, &scan);
+
+    if (scan.found && scan.end == offset) {
+        // Empty line
+        if (!sink(user, offset, 0, 0)) return LAYOUT_STOPPED;
+        return skip_line_break(source, scan.end);
+    }
+
+    // Whole paragraphs that were scanned at once go through the memo, a
+    // limit below what it keeps could stop halfway through one
+    if (!source->memo || !source->glyphs || source->no_wrap || (max_lines > 0 && max_lines < MEMO_MAX_LINES) ||
+        !scan.found) {
+        return layout_lines(source, offset, &scan, max_lines, sink, user);
+    }
+
+    ParagraphKey key;
+    memset(&key, 0, sizeof(ParagraphKey));
+    key.hash = paragraph_hash(source->text + offset, scan.end - offset);
+    key.check = paragraph_check(source->text + offset, scan.end - offset);
+    key.length = (Uint32)(scan.end - offset);
+    key.font_id = source->font_id;
+    key.max_width = source->max_width;
+    key.font_size = source->glyphs->font_size;
+    key.ignore_linebreaks = source->ignore_linebreaks;
+
+    MemoRecorder recorder;
+    int count = paragraph_memo_find(source->memo, &key, recorder.lines);
+    if (count < 0 && paragraph_memo_fits(source->memo, &key)) {
+        count = 1;
+        recorder.lines[0] = 0;
+        recorder.lines[1] = key.length << 1;
+    }
+    if (count >= 0) {
+        for (int i = 0; i < count; i++) {
+            Uint32 start = recorder.lines[2 * i];
+            Uint32 packed = recorder.lines[2 * i + 1];
+            if (!sink(user, offset + start, packed >> 1, (int)(packed & 1))) return LAYOUT_STOPPED;
+        }
+        return skip_line_break(source, scan.end);
+    }
+
+    recorder.sink = sink;
+    recorder.user = user;
+    recorder.base = offset;
+    recorder.count = 0;
+    size_t next = layout_lines(source, offset, &scan, max_lines, record_line, &recorder);
+    if (next == LAYOUT_STOPPED || next < scan.end) return next;
+    // A single line that is the whole paragraph fits every width it is as wide as
+    if (recorder.count == 1 && recorder.lines[1] == key.length << 1) {
+        paragraph_memo_add_line(source->memo, &key, scan.width);
+    } else if (recorder.count <= MEMO_MAX_LINES) {
+        paragraph_memo_add(source->memo, &key, recorder.lines, recorder.count);
+    }
+    return next;
+}
+
+// The lines from the line start at offset on, see layout_paragraph
+static size_t layout_lines(const LayoutSource* source, size_t offset, ParagraphScan* scan, int max_lines,
+    LineSink sink, void* user) {
+    const char* text = source->text;
+    size_t start = offset;
+    int produced = 0;
+    if (source->no_wrap) {
+        // The line is the rest of the paragraph, only its end is looked for
+        while (!scan->found) scan_paragraph(source, scan);
+        if (start < scan->end && !sink(user, start, scan->end - start, 0)) return LAYOUT_STOPPED;
+        return skip_line_break(source, scan->end);
+    }
+    while (start < scan->end) {
+        if (max_lines > 0 && produced == max_lines) return start;
+
+        // Find how much text fits, a line may reach past what was scanned so far
+        scan->width = INT_MAX;
+        size_t chars_that_fit = fit_line_length(source, text + start, scan->end - start, &scan->width);
+        while (start + chars_that_fit == scan->end && !scan->found) {
+            scan_paragraph(source, scan);
+            chars_that_fit = fit_line_length(source, text + start, scan->end - start, &scan->width);
+        }
+
+        if (chars_that_fit == 0) {
+            // Force at least one grapheme cluster if nothing fits
+            chars_that_fit = source->ascii ? 1 : utf8_cluster_length(text + start, scan->end - start);
+            while (chars_that_fit > scan->end - start && !scan->found) scan_paragraph(source, scan);
+            if (chars_that_fit > scan->end - start) chars_that_fit = scan->end - start;
+        }
+
+        // A wrapped line ends before its trailing whitespace, as when
+        // its length is derived from where the next line starts
+        int is_wrapped = start + chars_that_fit < scan->end;
+        size_t length = chars_that_fit;
+        while (is_wrapped && length > 0 && (text[start + length - 1] == ' ' || text[start + length - 1] == '\t' ||
+            is_break_char(text[start + length - 1]))) {
+            length--;
+        }
+
+        if (!sink(user, start, length, is_wrapped)) return LAYOUT_STOPPED;
+        produced++;
+
+        start += chars_that_fit;
+        // Skip whitespace at start of next line, breaks inside a
+        // paragraph join lines like spaces
+        for (;;) {
+            while (start < scan->end && (text[start] == ' ' || text[start] == '\t' || is_break_char(text[start]))) {
+                start++;
+            }
+            if (start < scan->end || scan->found) break;
+            scan_paragraph(source, scan);
+        }
+    }
+    return skip_line_break(source, scan->end);
+}
+
+static int append_to_prefix(void* user, size_t start, size_t length, int is_wrapped) {
+    PrefixSink* sink = user;
+    TextLayout* layout = sink->layout;
+    if (layout->worker && __atomic_load_n(&layout->worker->cancel, __ATOMIC_RELAXED)) return 0;
+
+    LineRecord* line = add_line_to_layout(layout);
+    if (!line) {
+        printf("Failed to add line to layout\n");
+        return 0;
+    }
+    *line = ((LineRecord)start << 1) | (is_wrapped ? 1 : 0);
+
+    __atomic_store_n(&layout->total_lines, layout->total_lines + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&layout->laid_out, start + length, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Lines of a sparse prefix are only counted
+static int count_in_prefix(void* user, size_t start, size_t length, int is_wrapped) {
+    PrefixSink* sink = user;
+    TextLayout* layout = sink->layout;
+    (void)is_wrapped;
+    if (layout->worker && __atomic_load_n(&layout->worker->cancel, __ATOMIC_RELAXED)) return 0;
+
+    __atomic_store_n(&layout->total_lines, layout->total_lines + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&layout->laid_out, start + length, __ATOMIC_RELAXED);
+    return 1;
+}
+
+static int add_shard_record(LayoutShard* shard, LineRecord record) {
+    if (shard->count == shard->capacity) {
+        int capacity = shard->capacity ? shard->capacity * 2 : SHARD_INITIAL_LINES;
+        LineRecord* records = realloc(shard->records, capacity * sizeof(LineRecord));
+        if (!records) {
+            printf("Failed to add line to layout shard\n");
+            shard->failed = 1;
+            return 0;
+        }
+        shard->records = records;
+        shard->capacity = capacity;
+    }
+    shard->records[shard->count++] = record;
+    return 1;
+}
+
+static int append_to_shard(void* user, size_t start, size_t length, int is_wrapped) {
+    LayoutShard* shard = user;
+    if (__atomic_load_n(shard->cancel, __ATOMIC_RELAXED)) return 0;
+
+    if (!add_shard_record(shard, ((LineRecord)start << 1) | (is_wrapped ? 1 : 0))) return 0;
+    __atomic_store_n(&shard->laid_out, start + length, __ATOMIC_RELAXED);
+    return 1;
+}
+
+static int count_in_shard(void* user, size_t start, size_t length, int is_wrapped) {
+    LayoutShard* shard = user;
+    (void)is_wrapped;
+    if (__atomic_load_n(shard->cancel, __ATOMIC_RELAXED)) return 0;
+
+    shard->lines++;
+    __atomic_store_n(&shard->laid_out, start + length, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Grow the prefix until it covers offset, or for budget ms when budget is not 0
+static void extend_prefix(TextLayout* layout, const LayoutSource* source, size_t offset, Uint32 budget) {
+    if (!source->text || !layout->directory) return;
+
+    PrefixSink sink = { layout, source };
+    LineSink add = layout->sparse ? count_in_prefix : append_to_prefix;
+    layout->last_calculated_width = source->max_width;
+    // A sparse layout always has a checkpoint at the start of the text
+    if (layout->sparse && layout->checkpoint_count == 0 && !add_checkpoint(layout, 0, 0)) return;
+
+    Uint32 started = budget ? SDL_GetTicks() : 0;
+    while (!layout->complete && layout->next_offset <= offset) {
+        if (layout->next_offset >= source->length) {
+            layout->complete = 1;
+            break;
+        }
+        // In chunks, so neither a slice nor a line close to the prefix has
+        // to wait for the rest of a long paragraph. The prefix may then end
+        // at a line start inside one, checkpoints stay at paragraph starts
+        size_t next = layout_paragraph(source, layout->next_offset, PREFIX_CHUNK_LINES, add, &sink);
+        if (next == LAYOUT_STOPPED) break;
+        if (layout->sparse && next < source->length && is_paragraph_break(source, next - 1)) {
+            count_paragraph(layout, next);
+        }
+        __atomic_store_n(&layout->next_offset, next, __ATOMIC_RELEASE);
+        if (budget && SDL_GetTicks() - started >= budget) break;
+    }
+
+    if (layout->next_offset >= source->length) {
+        __atomic_store_n(&layout->complete, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void extend_text_layout(TextLayout* layout, const LayoutSource* source, size_t offset) {
+    extend_prefix(layout, source, offset, 0);
+}
+
+int step_text_layout(TextLayout* layout, const LayoutSource* source, Uint32 budget) {
+    if (layout->worker || layout->complete) return 0;
+    extend_prefix(layout, source, source->length, budget ? budget : 1);
+    return !layout->complete;
+}
+
+static int layout_shard_main(void* data) {
+    LayoutShard* shard = data;
+    size_t offset = shard->start;
+    // A sparse shard collects checkpoints, starting with one of its own
+    if (shard->sparse && (!add_shard_record(shard, offset) || !add_shard_record(shard, 0))) return 0;
+
+    while (offset < shard->end) {
+        offset = layout_paragraph(&shard->source, offset, 0, shard->sparse ? count_in_shard : append_to_shard, shard);
+        if (offset == LAYOUT_STOPPED) {
+            shard->failed = 1;
+            break;
+        }
+        if (!shard->sparse || offset >= shard->end) continue;
+
+        shard->paragraphs++;
+        if (shard->paragraphs >= SPARSE_CHECKPOINT_PARAGRAPHS ||
+            shard->lines - (int)shard->records[shard->count - 1] >= SPARSE_CHECKPOINT_LINES) {
+            if (!add_shard_record(shard, offset) || !add_shard_record(shard, (LineRecord)shard->lines)) break;
+            shard->paragraphs = 0;
+        }
+    }
+    return 0;
+}
+
+// Publish the end of the prefix after its lines
+static void publish_prefix_end(TextLayout* layout, size_t next_offset, size_t length) {
+    __atomic_store_n(&layout->next_offset, next_offset, __ATOMIC_RELEASE);
+    if (next_offset >= length) {
+        __atomic_store_n(&layout->complete, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Takes back a shard that could only be appended in part. Its range is
+// laid out again from next_offset into the same records
+static int drop_appended(TextLayout* layout, int lines, int checkpoints) {
+    __atomic_store_n(&layout->checkpoint_count, checkpoints, __ATOMIC_RELEASE);
+    __atomic_store_n(&layout->total_lines, lines, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Move the lines of a finished shard to the prefix. The shards start at
+// paragraphs, so the lines only need to go after those already there
+static int append_shard(TextLayout* layout, LayoutShard* shard) {
+    int lines = layout->total_lines;
+    int checkpoints = layout->checkpoint_count;
+    if (layout->sparse) {
+        // Checkpoints are numbered from the start of the shard
+        for (int i = 0; i + 1 < shard->count; i += 2) {
+            if (!add_checkpoint(layout, (size_t)shard->records[i], layout->total_lines + (int)shard->records[i + 1])) {
+                return drop_appended(layout, lines, checkpoints);
+            }
+        }
+        layout->checkpoint_paragraphs = shard->paragraphs;
+        __atomic_store_n(&layout->total_lines, layout->total_lines + shard->lines, __ATOMIC_RELEASE);
+    }
+    for (int i = 0; !layout->sparse && i < shard->count; i++) {
+        if (!ensure_layout_capacity(layout)) return drop_appended(layout, lines, checkpoints);
+        int index = layout->total_lines;
+        *record_slot(layout, index) = shard->records[i];
+        __atomic_store_n(&layout->total_lines, index + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&shard->appended, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&layout->laid_out, shard->end, __ATOMIC_RELAXED);
+    publish_prefix_end(layout, shard->end, shard->source.length);
+    return 1;
+}
+
+static int layout_worker_main(void* data) {
+    TextLayout* layout = data;
+    LayoutWorker* worker = layout->worker;
+    LayoutShard* first = &worker->shards[0];
+
+    for (int i = 1; i < worker->shard_count; i++) {
+        worker->shards[i].thread = SDL_CreateThread(layout_shard_main, &worker->shards[i]);
+    }
+
+    // The first shard grows the prefix directly so it can be shown early
+    extend_text_layout(layout, &first->source, first->end - 1);
+
+    for (int i = 1; i < worker->shard_count; i++) {
+        LayoutShard* shard = &worker->shards[i];
+        if (shard->thread) {
+            SDL_WaitThread(shard->thread, NULL);
+            shard->thread = NULL;
+        }
+        if (__atomic_load_n(&worker->cancel, __ATOMIC_RELAXED) || layout->next_offset != shard->start) continue;
+
+        // Lay the shard out here if its thread did not make it
+        if (shard->failed) {
+            extend_text_layout(layout, &first->source, shard->end - 1);
+        } else if (!append_shard(layout, shard)) {
+            // The shards after it are still waited for, they are not appended either
+            continue;
+        }
+        free(shard->records);
+        shard->records = NULL;
+    }
+
+    // What could not be appended is laid out here, after the prefix
+    if (!__atomic_load_n(&worker->cancel, __ATOMIC_RELAXED) && !layout->complete) {
+        extend_text_layout(layout, &first->source, first->source.length);
+    }
+
+    // save_layout_when_complete can ask for the save until here
+    if (__atomic_exchange_n(&worker->save_cache, 2, __ATOMIC_ACQ_REL) == 1 && layout->complete) {
+        save_layout_cache(layout, worker->cache_path, &worker->cache_key);
+    }
+    __atomic_store_n(&worker->finished, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int layout_thread_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int count = (int)info.dwNumberOfProcessors;
+#else
+    int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (count < 1) count = 1;
+    return count > MAX_LAYOUT_THREADS ? MAX_LAYOUT_THREADS : count;
+}
+
+// Start of the paragraph after offset, shards may only start there
+static size_t next_paragraph_start(const LayoutSource* source, size_t offset) {
+    if (offset == 0) return 0;
+    size_t start = find_paragraph_start(source, offset);
+    if (start == offset) return start;
+    return skip_line_break(source, paragraph_end(source, offset));
+}
+
+static void release_layout_worker(LayoutWorker* worker) {
+    for (int i = 0; i < worker->shard_count; i++) {
+        LayoutShard* shard = &worker->shards[i];
+        glyph_cache_destroy(shard->glyphs);
+        if (shard->font) TTF_CloseFont(shard->font);
+        free(shard->records);
+    }
+    free(worker);
+}
+
+int start_layout_worker(TextLayout* layout, const LayoutSource* source, const char* font_path, int font_size,
+    int threads, const char* cache_path, const LayoutCacheKey* cache_key) {
+    if (layout->worker || layout->complete || !source->text || !layout->directory) return 0;
+
+    LayoutWorker* worker = calloc(1, sizeof(LayoutWorker));
+    if (!worker) return 0;
+
+    // Split what is left into paragraph aligned shards of at least MIN_SHARD_BYTES
+    if (threads <= 0) threads = layout_thread_count();
+    if (threads > MAX_LAYOUT_THREADS) threads = MAX_LAYOUT_THREADS;
+    size_t start = layout->next_offset;
+    size_t remaining = source->length - start;
+    if ((size_t)threads > remaining / MIN_SHARD_BYTES) threads = (int)(remaining / MIN_SHARD_BYTES);
+    if (threads < 1) threads = 1;
+
+    for (int i = 0; i < threads; i++) {
+        size_t end = i + 1 == threads ? source->length :
+            next_paragraph_start(source, start + remaining * (i + 1) / threads);
+        if (end <= start && worker->shard_count > 0) continue;
+
+        // Fonts are opened here, FreeType does not like faces being created concurrently
+        LayoutShard* shard = &worker->shards[worker->shard_count];
+        shard->font = TTF_OpenFont(font_path, font_size);
+        shard->glyphs = glyph_cache_create(shard->font, font_size);
+        if (!shard->font || !shard->glyphs) {
+            if (shard->font) TTF_CloseFont(shard->font);
+            shard->font = NULL;
+            shard->glyphs = NULL;
+            if (worker->shard_count == 0) {
+                free(worker);
+                return 0;
+            }
+            // Give the rest of the text to the previous shard
+            worker->shards[worker->shard_count - 1].end = source->length;
+            break;
+        }
+        shard->source = *source;
+        shard->source.glyphs = shard->glyphs;
+        shard->start = worker->shard_count == 0 ? layout->next_offset : start;
+        shard->end = end;
+        shard->laid_out = shard->start;
+        shard->sparse = layout->sparse;
+        shard->cancel = &worker->cancel;
+        worker->shard_count++;
+        start = end;
+    }
+
+    if (cache_path && cache_key) {
+        worker->save_cache = 1;
+        snprintf(worker->cache_path, LAYOUT_PATH_MAX, "%s", cache_path);
+        memcpy(&worker->cache_key, cache_key, sizeof(LayoutCacheKey));
+    }
+
+    layout->worker = worker;
+    worker->thread = SDL_CreateThread(layout_worker_main, layout);
+    if (!worker->thread) {
+        printf("Failed to start layout thread: %s\n", SDL_GetError());
+        layout->worker = NULL;
+        release_layout_worker(worker);
+        return 0;
+    }
+    return 1;
+}
+
+static void join_layout_worker(TextLayout* layout, int cancel) {
+    LayoutWorker* worker = layout->worker;
+    if (!worker) return;
+
+    if (cancel) __atomic_store_n(&worker->cancel, 1, __ATOMIC_RELAXED);
+    SDL_WaitThread(worker->thread, NULL);
+    // The fonts are closed here as FreeType faces should not be
+    // released while the main thread uses the library
+    release_layout_worker(worker);
+    layout->worker = NULL;
+}
+
+void stop_layout_worker(TextLayout* layout) {
+    join_layout_worker(layout, 1);
+}
+
+void wait_layout_worker(TextLayout* layout) {
+    join_layout_worker(layout, 0);
+}
+
+void save_layout_when_complete(TextLayout* layout, const char* cache_path, const LayoutCacheKey* cache_key) {
+    LayoutWorker* worker = layout->worker;
+    if (worker) {
+        // The thread only reads the path after it saw the request
+        int requested = __atomic_load_n(&worker->save_cache, __ATOMIC_ACQUIRE);
+        if (requested == 1) return;
+        if (requested == 0) {
+            snprintf(worker->cache_path, LAYOUT_PATH_MAX, "%s", cache_path);
+            memcpy(&worker->cache_key, cache_key, sizeof(LayoutCacheKey));
+            if (__atomic_compare_exchange_n(&worker->save_cache, &requested, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return;
+            }
+        }
+    }
+    // The worker is done with it, or there is none
+    if (__atomic_load_n(&layout->complete, __ATOMIC_ACQUIRE) && !layout->mapping) {
+        save_layout_cache(layout, cache_path, cache_key);
+    }
+}
+
+int layout_progress(TextLayout* layout, size_t* laid_out) {
+    LayoutWorker* worker = layout->worker;
+    if (__atomic_load_n(&layout->complete, __ATOMIC_ACQUIRE)) return 0;
+    if (!worker) {
+        // Only the main thread lays a sliced layout out
+        if (!layout->sliced) return 0;
+        *laid_out = layout->next_offset;
+        return 1;
+    }
+    // Out of memory, the prefix grows on demand from where the worker stopped
+    if (__atomic_load_n(&worker->finished, __ATOMIC_ACQUIRE)) {
+        wait_layout_worker(layout);
+        return layout_progress(layout, laid_out);
+    }
+
+    // The prefix plus what the other shards have done so far
+    size_t done = __atomic_load_n(&layout->laid_out, __ATOMIC_RELAXED);
+    for (int i = 1; i < worker->shard_count; i++) {
+        LayoutShard* shard = &worker->shards[i];
+        if (__atomic_load_n(&shard->appended, __ATOMIC_RELAXED)) continue;
+        done += __atomic_load_n(&shard->laid_out, __ATOMIC_RELAXED) - shard->start;
+    }
+    *laid_out = done;
+    return 1;
+}
+
+// Index of the prefix line containing offset, -1 when there is none
+static int find_line_for_offset(TextLayout* layout, size_t offset, int lines) {
+    int left = 0;
+    int right = lines - 1;
+    int found = -1;
+
+    while (left <= right) {
+        int mid = left + (right - left) / 2;
+        if ((size_t)(line_record(layout, mid) >> 1) <= offset) {
+            found = mid;
+            left = mid + 1;
+        } else {
+            right = mid - 1;
+        }
+    }
+    return found;
+}
+
+int layout_line_index(TextLayout* layout, const LayoutSource* source, size_t offset) {
+    if (!source->text || source->length == 0) return -1;
+    if (offset >= source->length) offset = source->length - 1;
+
+    PrefixState prefix;
+    load_prefix(layout, &prefix);
+    if (offset >= prefix.offset) return -1;
+    if (!layout->sparse) return find_line_for_offset(layout, offset, prefix.lines);
+
+    int checkpoint = find_checkpoint(layout, offset, 1);
+    if (checkpoint < 0) return -1;
+    LineSeek seek = { -1, offset, 0, { 0, 0, 0 } };
+    seek_from_checkpoint(layout, source, checkpoint, &seek);
+    if (seek.count == 0) return -1;
+    return (int)line_record(layout, 2 * checkpoint + 1) + seek.count - 1;
+}
+
+// Pages are lines_per_page whole lines from the first line, so the page
+// table is the line records themselves and moves with the window height.
+int layout_page_count(TextLayout* layout, int lines_per_page) {
+    if (!__atomic_load_n(&layout->complete, __ATOMIC_ACQUIRE)) return 0;
+    int lines = __atomic_load_n(&layout->total_lines, __ATOMIC_ACQUIRE);
+    return (lines + lines_per_page - 1) / lines_per_page;
+}
+
+int layout_page_at(TextLayout* layout, const LayoutSource* source, size_t offset, int lines_per_page) {
+    int index = layout_line_index(layout, source, offset);
+    return index < 0 ? -1 : index / lines_per_page;
+}
+
+int layout_page_start(TextLayout* layout, const LayoutSource* source, int page, int lines_per_page, LineInfo* line) {
+    if (page < 0) return 0;
+    return get_line_from_layout(layout, source, page * lines_per_page, line);
+}
+
+static int window_reserve(LineWindow* window, int count) {
+    if (count <= window->capacity) return 1;
+
+    int capacity = window->capacity ? window->capacity : WINDOW_CHUNK_LINES;
+    while (capacity < count) capacity *= 2;
+
+    LineInfo* lines = realloc(window->lines, capacity * sizeof(LineInfo));
+    if (!lines) return 0;
+    window->lines = lines;
+    window->capacity = capacity;
+    return 1;
+}
+
+static int append_to_window(void* user, size_t start, size_t length, int is_wrapped) {
+    LineWindow* window = user;
+
+    // Keep the window bounded by dropping its oldest half
+    if (window->count >= WINDOW_MAX_LINES) {
+        int keep = window->count / 2;
+        memmove(window->lines, window->lines + window->count - keep, keep * sizeof(LineInfo));
+        window->count = keep;
+    }
+    if (!window_reserve(window, window->count + 1)) return 0;
+
+    LineInfo* line = &window->lines[window->count++];
+    line->line_start_offset = start;
+    line->line_length = length;
+    line->is_wrapped = is_wrapped;
+    return 1;
+}
+
+// Collects the last WINDOW_CHUNK_LINES lines that start before stop_offset
+static int append_to_chunk(void* user, size_t start, size_t length, int is_wrapped) {
+    ChunkSink* chunk = user;
+    if (start >= chunk->stop_offset) return 0;
+
+    if (chunk->count == WINDOW_CHUNK_LINES) {
+        memmove(chunk->lines, chunk->lines + 1, (WINDOW_CHUNK_LINES - 1) * sizeof(LineInfo));
+        chunk->count--;
+    }
+
+    LineInfo* line = &chunk->lines[chunk->count++];
+    line->line_start_offset = start;
+    line->line_length = length;
+    line->is_wrapped = is_wrapped;
+    return 1;
+}
+
+// Index of the window line containing offset, -1 when outside the window
+static int window_find(const LineWindow* window, size_t offset) {
+    if (window->count == 0 || offset < window->lines[0].line_start_offset ||
+        offset >= window->next_offset) {
+        return -1;
+    }
+
+    int left = 0;
+    int right = window->count - 1;
+    while (left < right) {
+        int mid = left + (right - left + 1) / 2;
+        if (window->lines[mid].line_start_offset <= offset) {
+            left = mid;
+        } else {
+            right = mid - 1;
+        }
+    }
+    return left;
+}
+
+// Restart the window at the paragraph containing offset
+static int window_reset(LineWindow* window, const LayoutSource* source, size_t offset) {
+    window->count = 0;
+    window->next_offset = find_paragraph_start(source, offset);
+
+    // In chunks, so a long paragraph stops right after the line holding offset
+    while (window->next_offset <= offset && window->next_offset < source->length) {
+        size_t next = layout_paragraph(source, window->next_offset, WINDOW_CHUNK_LINES, append_to_window, window);
+        if (next == LAYOUT_STOPPED) return 0;
+        window->next_offset = next;
+    }
+    return window->count > 0;
+}
+
+static int window_extend_forward(LineWindow* window, const LayoutSource* source) {
+    if (window->count == 0 || window->next_offset >= source->length) return 0;
+
+    size_t next = layout_paragraph(source, window->next_offset, WINDOW_CHUNK_LINES, append_to_window, window);
+    if (next == LAYOUT_STOPPED) return 0;
+    window->next_offset = next;
+    return 1;
+}
+
+static int window_extend_backward(LineWindow* window, const LayoutSource* source) {
+    if (window->count == 0) return 0;
+    size_t first = window->lines[0].line_start_offset;
+    if (first == 0) return 0;
+
+    // Lay out the paragraph before the window, or the start of the
+    // paragraph the window begins in
+    size_t start = find_paragraph_start(source, first);
+    if (start == first) {
+        start = find_paragraph_start(source, first - 1);
+    }
+
+    LineInfo lines[WINDOW_CHUNK_LINES];
+    ChunkSink chunk = { lines, 0, first };
+    size_t offset = start;
+    while (offset < first) {
+        offset = layout_paragraph(source, offset, 0, append_to_chunk, &chunk);
+        if (offset == LAYOUT_STOPPED) break;
+    }
+    if (chunk.count == 0 || !window_reserve(window, window->count + chunk.count)) return 0;
+
+    if (window->count + chunk.count > WINDOW_MAX_LINES) {
+        window->count = WINDOW_MAX_LINES - chunk.count;
+        window->next_offset = window->lines[window->count].line_start_offset;
+    }
+    memmove(window->lines + chunk.count, window->lines, window->count * sizeof(LineInfo));
+    memcpy(window->lines, lines, chunk.count * sizeof(LineInfo));
+    window->count += chunk.count;
+    return 1;
+}
+
+int layout_line_at(TextLayout* layout, const LayoutSource* source, size_t offset, LineInfo* line) {
+    if (!source->text || source->length == 0) return 0;
+    if (offset >= source->length) offset = source->length - 1;
+
+    // Close to the prefix it is cheaper to extend it than to open a window,
+    // unless a worker owns the prefix
+    if (!layout->worker && !layout->complete && offset >= layout->next_offset &&
+        offset - layout->next_offset < PREFIX_EXTEND_LIMIT) {
+        extend_text_layout(layout, source, offset);
+    }
+
+    PrefixState prefix;
+    load_prefix(layout, &prefix);
+    if (!layout->sparse && offset < prefix.offset) {
+        int index = find_line_for_offset(layout, offset, prefix.lines);
+        if (index >= 0 && decode_line(layout, source, &prefix, index, line)) return 1;
+    }
+
+    LineWindow* window = &layout->window;
+    int index = window_find(window, offset);
+    if (index < 0) {
+        if (!window_reset(window, source, offset)) return 0;
+        index = window_find(window, offset);
+        if (index < 0) return 0;
+    }
+    *line = window->lines[index];
+    return 1;
+}
+
+int layout_next_line(TextLayout* layout, const LayoutSource* source, const LineInfo* line, LineInfo* next) {
+    size_t start = line->line_start_offset;
+
+    PrefixState prefix;
+    load_prefix(layout, &prefix);
+    if (!layout->sparse && start < prefix.offset) {
+        int index = find_line_for_offset(layout, start, prefix.lines);
+        if (index + 1 >= prefix.lines && !layout->worker && !prefix.complete) {
+            extend_text_layout(layout, source, layout->next_offset);
+            load_prefix(layout, &prefix);
+        }
+        if (index >= 0 && index + 1 < prefix.lines && decode_line(layout, source, &prefix, index + 1, next)) {
+            return 1;
+        }
+        if (prefix.complete) return 0;
+    }
+
+    LineWindow* window = &layout->window;
+    int index = window_find(window, start);
+    if (index < 0) {
+        if (!window_reset(window, source, start)) return 0;
+        index = window_find(window, start);
+    }
+    if (index >= 0 && index + 1 >= window->count) {
+        if (!window_extend_forward(window, source)) return 0;
+        index = window_find(window, start);
+    }
+    if (index < 0 || index + 1 >= window->count) return 0;
+
+    *next = window->lines[index + 1];
+    return 1;
+}
+
+int layout_prev_line(TextLayout* layout, const LayoutSource* source, const LineInfo* line, LineInfo* prev) {
+    size_t start = line->line_start_offset;
+    if (start == 0) return 0;
+
+    // The previous line is the one holding the byte before this line
+    PrefixState prefix;
+    load_prefix(layout, &prefix);
+    if (!layout->sparse && start <= prefix.offset) {
+        int index = find_line_for_offset(layout, start - 1, prefix.lines);
+        if (index >= 0 && decode_line(layout, source, &prefix, index, prev)) return 1;
+    }
+
+    LineWindow* window = &layout->window;
+    int index = window_find(window, start);
+    if (index < 0) {
+        if (!window_reset(window, source, start)) return 0;
+        index = window_find(window, start);
+    }
+    if (index == 0) {
+        if (!window_extend_backward(window, source)) return 0;
+        index = window_find(window, start);
+    }
+    if (index <= 0) return 0;
+
+    *prev = window->lines[index - 1];
+    return 1;
+}
@@ -0,0 +1,300 @@
+/* layout.h */
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stddef.h>
+#include <sys/time.h>
+#include <SDL/SDL_thread.h>
+#include "glyph_cache.h"
+#include "paragraph_memo.h"
+
+#define DEFAULT_BLOCKSIZE 64
+#define MAX_BLOCKSIZE 16384
+#define TARGET_BLOCK_COUNT 256
+#define ESTIMATED_LINE_BYTES 32
+#define INITIAL_DIRECTORY_SIZE 16
+#define ARENA_MAX_CHUNK_BLOCKS 64
+#define LAYOUT_PATH_MAX 1024
+#define MAX_LAYOUT_THREADS 8
+#define MIN_SHARD_BYTES (256 * 1024)
+#define SHARD_INITIAL_LINES 1024
+#define WINDOW_MAX_LINES 1024
+#define WINDOW_CHUNK_LINES 64
+#define PREFIX_EXTEND_LIMIT (64 * 1024)
+#define SPARSE_CHECKPOINT_PARAGRAPHS 64
+#define SPARSE_CHECKPOINT_LINES 1024
+#define LAYOUT_SLICE_MS 12
+
+// Make block size configurable
+typedef struct {
+    size_t block_size;
+    struct timeval start_time;
+    struct timeval end_time;
+    long memory_used;            // Arena, directories and mapped layout
+    int total_blocks;
+} LayoutStats;
+
+typedef struct {
+    size_t line_start_offset;  // Offset in the source text where this line starts
+    size_t line_length;        // Length of this line in bytes
+    int is_wrapped;            // Whether this line was wrapped (split due to width)
+} LineInfo;
+
+/* A line as the layout stores it: start offset << 1 | is_wrapped.
+ * The length follows from where the next line starts and the y
+ * position from the line index times the line height.
+ */
+typedef Uint64 LineRecord;
+
+/* Pointers to the blocks of block_size lines. A full directory is replaced
+ * by a copy twice its size; readers may still hold the old one, so it is
+ * only freed with the layout.
+ */
+typedef struct LineDirectory {
+    struct LineDirectory* previous;
+    int capacity;
+    LineRecord* blocks[];  // Flexible array member
+} LineDirectory;
+
+/* Memory the line blocks are carved from. Every chunk is twice as big as
+ * the one before, up to ARENA_MAX_CHUNK_BLOCKS blocks. A relayout reuses
+ * the chunks, they are only freed with the layout.
+ */
+typedef struct LayoutArenaChunk {
+    struct LayoutArenaChunk* next;
+    size_t capacity;             // Records the chunk holds
+    size_t used;
+    LineRecord records[];        // Flexible array member
+} LayoutArenaChunk;
+
+typedef struct {
+    LayoutArenaChunk* first;
+    LayoutArenaChunk* current;   // Chunk blocks are carved from now
+    size_t reserved;             // Bytes allocated for all chunks
+} LayoutArena;
+
+/* Lines laid out around a position the prefix has not reached yet,
+ * or around the viewport when the layout is sparse
+ */
+typedef struct {
+    LineInfo* lines;
+    int count;
+    int capacity;
+    size_t next_offset;          // Where the line after the last one starts
+} LineWindow;
+
+/* What a layout is computed from. With ignore_linebreaks the text is
+ * read as the reflowed view, see is_paragraph_break. With no_wrap every
+ * paragraph is one line however wide it is, nothing is measured and the
+ * lines do not depend on the font or max_width. An ascii text, see
+ * is_ascii_text, is measured byte by byte into the same lines.
+ */
+typedef struct {
+    const char* text;
+    size_t length;
+    GlyphCache* glyphs;
+    Uint64 font_id;              // paragraph_hash of the font path, tells fonts apart in the memo
+    int max_width;
+    int line_height;
+    int ignore_linebreaks;
+    int no_wrap;
+    int ascii;
+    ParagraphMemo* memo;         // Lines of paragraphs laid out before, may be NULL
+} LayoutSource;
+
+/* Everything a finished layout depends on, a saved layout is only
+ * used again when all of it matches
+ */
+typedef struct {
+    char text_path[LAYOUT_PATH_MAX];
+    char font_path[LAYOUT_PATH_MAX];
+    char encoding[32];
+    Uint64 file_size;
+    Sint64 file_mtime;
+    Uint64 text_length;
+    int font_size;
+    int window_width;
+    int margins;
+    int line_spacing;            // LINE_SPACING in thousandths
+    int max_width;
+    int line_height;
+    int ignore_linebreaks;
+} LayoutCacheKey;
+
+/* A paragraph aligned part of the text laid out by its own thread and
+ * font, as TTF_Font and GlyphCache are not thread safe. Lines of all but
+ * the first shard are collected here and appended to the prefix in order.
+ */
+typedef struct {
+    SDL_Thread* thread;
+    TTF_Font* font;
+    GlyphCache* glyphs;
+    LayoutSource source;         // With this shard's glyphs
+    size_t start;
+    size_t end;
+    LineRecord* records;         // Lines, or checkpoints numbered from the shard start when sparse
+    int count;
+    int capacity;
+    int sparse;
+    int lines;                   // Lines laid out when sparse
+    int paragraphs;              // Paragraphs since the last checkpoint when sparse
+    size_t laid_out;             // End of the last line laid out, for progress
+    int appended;                // Lines moved to the prefix
+    int failed;
+    const int* cancel;
+} LayoutShard;
+
+/* Lays out the whole prefix in the background. Its thread lays out the
+ * first shard straight into the prefix and is its only writer while it
+ * runs, the other shards are appended once their threads are done.
+ */
+typedef struct {
+    SDL_Thread* thread;
+    LayoutShard shards[MAX_LAYOUT_THREADS];
+    int shard_count;
+    int cancel;
+    int finished;                // The thread is done, with the layout complete unless it ran out of memory
+    int save_cache;              // 1 to save the finished layout to cache_path, 2 once the thread is past that
+    char cache_path[LAYOUT_PATH_MAX];
+    LayoutCacheKey cache_key;
+} LayoutWorker;
+
+/* Lines are laid out on demand: the prefix grows from the start of the
+ * text, positions far beyond it are served from a detached window.
+ * The lines, next_offset and complete are published in that order with
+ * release stores, so the prefix can be read while a worker extends it.
+ *
+ * A sparse layout does not keep the lines of its prefix, only counts
+ * them. Every SPARSE_CHECKPOINT_PARAGRAPHS paragraphs, or sooner after
+ * SPARSE_CHECKPOINT_LINES lines, it records a checkpoint in two records:
+ * the offset of a paragraph start and the index of its first line. Lines
+ * are then always served from the window, and a line index is found by
+ * laying out from the nearest checkpoint. Set sparse before laying out.
+ *
+ * A sliced layout has no worker, the main loop grows its prefix a slice
+ * at a time with step_text_layout, for devices with a single core.
+ */
+typedef struct {
+    LineDirectory* directory;
+    int total_lines;
+    int last_calculated_width;
+    size_t block_size;           // Lines per block, a power of two
+    int block_shift;             // log2 of block_size
+    LayoutStats stats;           // Stats for this layout
+    int sparse;                  // Keep checkpoints instead of lines
+    int checkpoint_count;
+    int checkpoint_paragraphs;   // Paragraphs since the last checkpoint
+    int sliced;                  // Laid out by step_text_layout instead of a worker
+    size_t next_offset;          // Where the prefix continues
+    int complete;                // Prefix covers the whole text
+    size_t laid_out;             // End of the last line laid out, for progress
+    LineWindow window;
+    LayoutArena arena;
+    LayoutWorker* worker;        // Background layout, NULL when laid out on demand
+    void* mapping;               // Saved layout the blocks point into, if any
+    size_t mapping_size;
+} TextLayout;
+
+void start_timing(LayoutStats* stats);
+void end_timing(LayoutStats* stats);
+long get_elapsed_ms(LayoutStats* stats);
+
+/* Block size suited to a text of this length */
+size_t layout_block_size(size_t text_length);
+void init_text_layout(TextLayout* layout, size_t block_size);
+void free_text_layout(TextLayout* layout);
+
+/* Empty an initialized layout for a new layout, keeping the memory of its
+ * blocks to lay the new one out in
+ */
+void reset_text_layout(TextLayout* layout, size_t block_size);
+int ensure_layout_capacity(TextLayout* layout);
+/* Line index of the text, in a sparse layout laid out from the checkpoint
+ * before it. Returns 0 when the prefix has not reached the line yet.
+ */
+int get_line_from_layout(TextLayout* layout, const LayoutSource* source, int index, LineInfo* line);
+
+/* Index of the line holding offset, -1 when the prefix has not reached it */
+int layout_line_index(TextLayout* layout, const LayoutSource* source, size_t offset);
+/* Pages of lines_per_page whole lines, numbered from 0. The count is 0
+ * until the layout is complete, layout_page_at returns -1 and
+ * layout_page_start 0 where the prefix has not reached the page yet.
+ */
+int layout_page_count(TextLayout* layout, int lines_per_page);
+int layout_page_at(TextLayout* layout, const LayoutSource* source, size_t offset, int lines_per_page);
+int layout_page_start(TextLayout* layout, const LayoutSource* source, int page, int lines_per_page, LineInfo* line);
+/* Bytes of text that fit in max_width, ending at a space or a break
+ * can_break_between allows when there is one. Line breaks in the text
+ * are measured as spaces, they only occur inside a paragraph of the
+ * ignore linebreaks view.
+ */
+size_t find_fitting_text_length(GlyphCache* glyphs, const char* text, size_t max_length, int max_width);
+
+/* Bytes of a line that end at or left of x, cut between characters. The
+ * x where the character after them starts is stored in start_x. Used to
+ * draw only the part of a no_wrap line inside the window.
+ */
+size_t find_text_offset_at(GlyphCache* glyphs, const char* text, size_t length, int x, int* start_x);
+
+/* Whether the byte at offset ends a paragraph. Normally every CR and LF
+ * does (a CR LF pair once). In the ignore linebreaks view only a CR or LF
+ * next to another one does, a lone break joins its lines like a space.
+ * Both views have the same offsets.
+ */
+int is_paragraph_break(const LayoutSource* source, size_t offset);
+
+/* Copy length bytes of the text at start as shown, line breaks joining
+ * lines in the ignore linebreaks view become spaces. Not terminated.
+ */
+void copy_source_text(const LayoutSource* source, size_t start, size_t length, char* buffer);
+
+/* Grow the prefix until it covers offset. It grows a chunk of lines at a
+ * time and may end inside a paragraph, the next line start is kept.
+ */
+void extend_text_layout(TextLayout* layout, const LayoutSource* source, size_t offset);
+
+/* Lay out the prefix for up to budget ms, on the thread that draws. The
+ * budget is checked between chunks of lines, so a paragraph longer than a
+ * slice goes on in the next one. Returns 1 while the text is not laid out
+ * yet.
+ */
+int step_text_layout(TextLayout* layout, const LayoutSource* source, Uint32 budget);
+
+/* Number of processors, the default for start_layout_worker */
+int layout_thread_count(void);
+
+/* Lay out the whole text in the background, split over up to threads
+ * threads (0 for one per processor) that each open their own font.
+ * When cache_path is given the finished layout is saved there.
+ * Returns 0 if the thread could not be started, the layout then keeps
+ * being extended on demand. free_text_layout stops the worker.
+ */
+int start_layout_worker(TextLayout* layout, const LayoutSource* source, const char* font_path, int font_size,
+    int threads, const char* cache_path, const LayoutCacheKey* cache_key);
+void stop_layout_worker(TextLayout* layout);
+
+/* Wait until the worker laid out the whole text */
+void wait_layout_worker(TextLayout* layout);
+
+/* Save the layout to cache_path once it is complete: by its worker when
+ * it is still running, else right away. For layouts started without a
+ * cache path, such as the ones laid out ahead.
+ */
+void save_layout_when_complete(TextLayout* layout, const char* cache_path, const LayoutCacheKey* cache_key);
+
+/* Returns 1 while a worker, or step_text_layout for a sliced layout, is
+ * still laying out, with the bytes it has done. A worker that finished
+ * without completing the layout is joined here, the rest of the text is
+ * then laid out on demand.
+ */
+int layout_progress(TextLayout* layout, size_t* laid_out);
+
+/* Line navigation, laying out only the paragraphs that are needed.
+ * layout_line_at returns the line holding offset, found by binary search
+ * where the prefix covers it. Return 0 when there is no such line.
+ */
+int layout_line_at(TextLayout* layout, const LayoutSource* source, size_t offset, LineInfo* line);
+int layout_next_line(TextLayout* layout, const LayoutSource* source, const LineInfo* line, LineInfo* next);
+int layout_prev_line(TextLayout* layout, const LayoutSource* source, const LineInfo* line, LineInfo* prev);
+
+#endif
@@ -0,0 +1,249 @@
+/* layout_cache.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "layout_cache.h"
+
+typedef struct {
+    char magic[4];
+    int version;
+    LayoutCacheKey key;
+    Uint64 line_count;           // LineRecords following the header
+} LayoutCacheHeader;
+
+// Start of the names of every cache file of a text
+#define TEXT_PREFIX_LENGTH 16  // "layout_" and eight hex digits and "_"
+
+void layout_cache_path(char* path, size_t size, const char* settings_dir, const LayoutCacheKey* key) {
+    // FNV-1a hash of the text path keeps the name short and filesystem safe
+    Uint32 hash = 2166136261u;
+    for (const char* c = key->text_path; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 16777619u;
+    }
+    snprintf(path, size, "%s/layout_%08x_%d_%d_%d.bin", settings_dir, (unsigned int)hash,
+        key->ignore_linebreaks ? 1 : 0, key->font_size, key->max_width);
+}
+
+// Remove the least recently used cache files of the text that path was
+// saved for, until LAYOUT_CACHE_FILES_PER_TEXT are left
+static void prune_layout_caches(const char* path) {
+    const char* name = strrchr(path, '/');
+    if (!name || strlen(name + 1) < TEXT_PREFIX_LENGTH) return;
+    size_t dir_length = (size_t)(name - path);
+    name++;
+
+    for (;;) {
+        char oldest[LAYOUT_PATH_MAX + 32];
+        Sint64 oldest_time = 0;
+        int count = 0;
+#ifdef _WIN32
+        char pattern[LAYOUT_PATH_MAX + 32];
+        snprintf(pattern, sizeof(pattern), "%.*s/%.*s*.bin", (int)dir_length, path, TEXT_PREFIX_LENGTH, name);
+        WIN32_FIND_DATAA found;
+        HANDLE find = FindFirstFileA(pattern, &found);
+        if (find == INVALID_HANDLE_VALUE) return;
+        do {
+            Sint64 time = ((Sint64)found.ftLastWriteTime.dwHighDateTime << 32) | found.ftLastWriteTime.dwLowDateTime;
+            const char* entry = found.cFileName;
+#else
+        char dir_path[LAYOUT_PATH_MAX];
+        snprintf(dir_path, sizeof(dir_path), "%.*s", (int)dir_length, path);
+        DIR* dir = opendir(dir_path);
+        if (!dir) return;
+        struct dirent* found;
+        while ((found = readdir(dir))) {
+            const char* entry = found->d_name;
+            size_t length = strlen(entry);
+            if (strncmp(entry, name, TEXT_PREFIX_LENGTH) != 0 || length < 4 || strcmp(entry + length - 4, ".bin") != 0) {
+                continue;
+            }
+            char entry_path[LAYOUT_PATH_MAX + 32];
+            snprintf(entry_path, sizeof(entry_path), "%s/%s", dir_path, entry);
+            struct stat entry_stat;
+            if (stat(entry_path, &entry_stat) != 0) continue;
+            Sint64 time = (Sint64)entry_stat.st_mtime;
+#endif
+            count++;
+            if (strcmp(entry, name) != 0 && (!oldest_time || time < oldest_time)) {
+                oldest_time = time;
+                snprintf(oldest, sizeof(oldest), "%.*s/%s", (int)dir_length, path, entry);
+            }
+#ifdef _WIN32
+        } while (FindNextFileA(find, &found));
+        FindClose(find);
+#else
+        }
+        closedir(dir);
+#endif
+        if (count <= LAYOUT_CACHE_FILES_PER_TEXT || !oldest_time || remove(oldest) != 0) return;
+    }
+}
+
+static int map_file(const char* path, void** data, size_t* size) {
+#ifdef _WIN32
+    // No mmap here, read the file instead
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+    _fseeki64(file, 0, SEEK_END);
+    *size = (size_t)_ftelli64(file);
+    rewind(file);
+    *data = malloc(*size ? *size : 1);
+    if (!*data || fread(*data, 1, *size, file) != *size) {
+        free(*data);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    return 1;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    *size = (size_t)file_stat.st_size;
+    *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return *data != MAP_FAILED;
+#endif
+}
+
+static void unmap_file(void* data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// Line starts begin at 0, strictly increase and stay inside the text,
+// else decode_line would derive lengths past its end
+static int records_are_valid(const LineRecord* records, size_t count, Uint64 text_length) {
+    if (count > 0 && records[0] >> 1 != 0) return 0;
+    for (size_t i = 1; i < count; i++) {
+        if (records[i] >> 1 <= records[i - 1] >> 1) return 0;
+    }
+    return count == 0 || records[count - 1] >> 1 < text_length;
+}
+
+int load_layout_cache(TextLayout* layout, const char* path, const LayoutCacheKey* key) {
+    // Only layouts with all their lines are saved
+    if (!layout->directory || layout->total_lines > 0 || layout->worker || layout->sparse) return 0;
+
+    void* data;
+    size_t size;
+    if (!map_file(path, &data, &size)) return 0;
+
+    const LayoutCacheHeader* header = data;
+    LineRecord* records = (LineRecord*)(header + 1);
+    if (size < sizeof(LayoutCacheHeader) ||
+        memcmp(header->magic, LAYOUT_CACHE_MAGIC, 4) != 0 ||
+        header->version != LAYOUT_CACHE_VERSION ||
+        memcmp(&header->key, key, sizeof(LayoutCacheKey)) != 0 ||
+        header->line_count > INT_MAX ||
+        (size - sizeof(LayoutCacheHeader)) % sizeof(LineRecord) != 0 ||
+        header->line_count != (size - sizeof(LayoutCacheHeader)) / sizeof(LineRecord) ||
+        !records_are_valid(records, (size_t)header->line_count, key->text_length)) {
+        unmap_file(data, size);
+        return 0;
+    }
+
+    // The blocks point straight into the mapping, only the directory is allocated
+    int lines = (int)header->line_count;
+    int blocks = (int)((header->line_count + layout->block_size - 1) >> layout->block_shift);
+    int capacity = blocks > INITIAL_DIRECTORY_SIZE ? blocks : INITIAL_DIRECTORY_SIZE;
+    size_t alloc_size = sizeof(LineDirectory) + capacity * sizeof(LineRecord*);
+    LineDirectory* directory = calloc(1, alloc_size);
+    if (!directory) {
+        unmap_file(data, size);
+        return 0;
+    }
+    directory->capacity = capacity;
+    for (int i = 0; i < blocks; i++) {
+        directory->blocks[i] = records + ((size_t)i << layout->block_shift);
+    }
+
+    free(layout->directory);
+    layout->directory = directory;
+    layout->mapping = data;
+    layout->mapping_size = size;
+    layout->stats.memory_used = (long)(alloc_size + size + layout->arena.reserved);
+    layout->stats.total_blocks = blocks;
+    layout->last_calculated_width = key->max_width;
+    layout->total_lines = lines;
+    layout->next_offset = (size_t)key->text_length;
+    layout->laid_out = (size_t)key->text_length;
+    layout->complete = 1;
+
+    // Used now, pruning goes by the modification time
+#ifdef _WIN32
+    _utime(path, NULL);
+#else
+    utime(path, NULL);
+#endif
+    return 1;
+}
+
+int save_layout_cache(TextLayout* layout, const char* path, const LayoutCacheKey* key) {
+    if (!layout->complete || !layout->directory || layout->sparse) return 0;
+
+    // Written next to the cache and renamed, so a cache is never half written
+    char temp_path[LAYOUT_PATH_MAX + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) return 0;
+
+    LayoutCacheHeader header;
+    memset(&header, 0, sizeof(LayoutCacheHeader));
+    memcpy(header.magic, LAYOUT_CACHE_MAGIC, 4);
+    header.version = LAYOUT_CACHE_VERSION;
+    memcpy(&header.key, key, sizeof(LayoutCacheKey));
+    header.line_count = layout->total_lines;
+    int ok = fwrite(&header, sizeof(LayoutCacheHeader), 1, file) == 1;
+
+    size_t remaining = layout->total_lines;
+    for (int i = 0; ok && remaining > 0; i++) {
+        size_t count = remaining < layout->block_size ? remaining : layout->block_size;
+        ok = fwrite(layout->directory->blocks[i], sizeof(LineRecord), count, file) == count;
+        remaining -= count;
+    }
+
+    if (fclose(file) != 0) ok = 0;
+    if (ok) {
+#ifdef _WIN32
+        remove(path);
+#endif
+        ok = rename(temp_path, path) == 0;
+    }
+    if (!ok) {
+        printf("Failed to save layout cache: %s\n", path);
+        remove(temp_path);
+    } else {
+        prune_layout_caches(path);
+    }
+    return ok;
+}
+
+void release_layout_cache(TextLayout* layout) {
+    if (!layout->mapping) return;
+    unmap_file(layout->mapping, layout->mapping_size);
+    layout->mapping = NULL;
+    layout->mapping_size = 0;
+}
@@ -0,0 +1,31 @@
+/* layout_cache.h */
+#ifndef LAYOUT_CACHE_H
+#define LAYOUT_CACHE_H
+
+#include "layout.h"
+
+#define LAYOUT_CACHE_MAGIC "VTXL"
+#define LAYOUT_CACHE_VERSION 4
+
+#define LAYOUT_CACHE_FILES_PER_TEXT 8  // Saved layouts kept for a text, the least recently used go first
+
+/* Name of the cache file for the text, mode, font size and width of key
+ * inside settings_dir. It is replaced when the rest of the key changes.
+ */
+void layout_cache_path(char* path, size_t size, const char* settings_dir, const LayoutCacheKey* key);
+
+/* Map a saved layout into an empty, initialized layout, which makes it
+ * the most recently used of its text.
+ * Returns 0 when there is none or it was made for another key.
+ */
+int load_layout_cache(TextLayout* layout, const char* path, const LayoutCacheKey* key);
+
+/* Write a complete layout, returns 0 on error. The oldest files of the
+ * text are removed beyond LAYOUT_CACHE_FILES_PER_TEXT.
+ */
+int save_layout_cache(TextLayout* layout, const char* path, const LayoutCacheKey* key);
+
+/* Unmap a layout loaded by load_layout_cache */
+void release_layout_cache(TextLayout* layout);
+
+#endif
@@ -0,0 +1,92 @@
+/* layout_pool.c */
+#include <string.h>
+#include "layout_pool.h"
+
+void init_layout_pool(LayoutPool* pool, size_t memory_limit) {
+    memset(pool, 0, sizeof(LayoutPool));
+    pool->memory_limit = memory_limit;
+}
+
+static void drop_layout(PooledLayout* entry) {
+    free_text_layout(&entry->layout);
+    memset(entry, 0, sizeof(PooledLayout));
+}
+
+void free_layout_pool(LayoutPool* pool) {
+    for (int i = 0; i < LAYOUT_POOL_SIZE; i++) {
+        if (pool->entries[i].in_use) drop_layout(&pool->entries[i]);
+    }
+}
+
+PooledLayout* layout_pool_find(LayoutPool* pool, int font_size, int max_width, int ignore_linebreaks) {
+    for (int i = 0; i < LAYOUT_POOL_SIZE; i++) {
+        PooledLayout* entry = &pool->entries[i];
+        if (entry->in_use && entry->font_size == font_size && entry->max_width == max_width &&
+            entry->ignore_linebreaks == ignore_linebreaks) {
+            entry->last_used = ++pool->clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+size_t layout_memory(TextLayout* layout) {
+    // The worker only updates the stats before it publishes complete
+    if (!__atomic_load_n(&layout->complete, __ATOMIC_ACQUIRE)) return 0;
+    return (size_t)layout->stats.memory_used;
+}
+
+static int is_kept(const PooledLayout* entry, TextLayout* const* keep, int keep_count) {
+    for (int i = 0; i < keep_count; i++) {
+        if (keep[i] == &entry->layout) return 1;
+    }
+    return 0;
+}
+
+// Least recently used layout that may be dropped, NULL if there is none
+static PooledLayout* find_victim(LayoutPool* pool, const PooledLayout* added, TextLayout* const* keep, int keep_count) {
+    PooledLayout* victim = NULL;
+    for (int i = 0; i < LAYOUT_POOL_SIZE; i++) {
+        PooledLayout* entry = &pool->entries[i];
+        if (!entry->in_use || entry == added || is_kept(entry, keep, keep_count)) continue;
+        if (!victim || entry->last_used < victim->last_used) victim = entry;
+    }
+    return victim;
+}
+
+PooledLayout* layout_pool_add(LayoutPool* pool, int font_size, int max_width, int ignore_linebreaks,
+    size_t block_size, TextLayout* const* keep, int keep_count) {
+    PooledLayout* entry = NULL;
+    for (int i = 0; i < LAYOUT_POOL_SIZE && !entry; i++) {
+        if (!pool->entries[i].in_use) entry = &pool->entries[i];
+    }
+    if (entry) {
+        init_text_layout(&entry->layout, block_size);
+    } else {
+        // The new layout is laid out in the memory of the one it replaces
+        entry = find_victim(pool, NULL, keep, keep_count);
+        if (!entry) return NULL;
+        reset_text_layout(&entry->layout, block_size);
+    }
+
+    entry->in_use = 1;
+    entry->speculative = 0;
+    entry->font_size = font_size;
+    entry->max_width = max_width;
+    entry->ignore_linebreaks = ignore_linebreaks;
+    entry->last_used = ++pool->clock;
+
+    // Stay within the memory limit
+    for (;;) {
+        size_t memory = 0;
+        for (int i = 0; i < LAYOUT_POOL_SIZE; i++) {
+            if (pool->entries[i].in_use) memory += layout_memory(&pool->entries[i].layout);
+        }
+        if (memory <= pool->memory_limit) break;
+
+        PooledLayout* victim = find_victim(pool, entry, keep, keep_count);
+        if (!victim) break;
+        drop_layout(victim);
+    }
+    return entry;
+}
@@ -0,0 +1,49 @@
+/* layout_pool.h */
+#ifndef LAYOUT_POOL_H
+#define LAYOUT_POOL_H
+
+#include "layout.h"
+
+#define LAYOUT_POOL_SIZE 6
+#define LAYOUT_POOL_MEMORY (16 * 1024 * 1024)
+
+/* A layout of the text and what it was laid out for */
+typedef struct {
+    TextLayout layout;
+    int in_use;
+    int font_size;
+    int max_width;
+    int ignore_linebreaks;
+    int speculative;             // Laid out ahead, not saved to the layout cache
+    Uint32 last_used;            // Pool clock when it was last looked up
+} PooledLayout;
+
+/* Layouts of one text for several (font size, width, mode) keys, so going
+ * back to a size does not lay the text out again. The least recently used
+ * layouts are dropped when the pool is full or its finished layouts take
+ * more than memory_limit bytes.
+ */
+typedef struct {
+    PooledLayout entries[LAYOUT_POOL_SIZE];
+    size_t memory_limit;
+    Uint32 clock;
+} LayoutPool;
+
+void init_layout_pool(LayoutPool* pool, size_t memory_limit);
+
+/* Free every layout, stopping their workers */
+void free_layout_pool(LayoutPool* pool);
+
+/* Layout for the key, or NULL when the pool has none */
+PooledLayout* layout_pool_find(LayoutPool* pool, int font_size, int max_width, int ignore_linebreaks);
+
+/* Add an empty, initialized layout for the key. The layouts in keep are
+ * never dropped to make room. Returns NULL when nothing can be dropped.
+ */
+PooledLayout* layout_pool_add(LayoutPool* pool, int font_size, int max_width, int ignore_linebreaks,
+    size_t block_size, TextLayout* const* keep, int keep_count);
+
+/* Bytes held by a finished layout, 0 while it is still being laid out */
+size_t layout_memory(TextLayout* layout);
+
+#endif
@@ -0,0 +1,93 @@
+/* line_break.c */
+#include <stdlib.h>
+#include "glyph_cache.h"
+#include "line_break.h"
+#include "unicode_tables.h"
+
+int line_break_class(Uint32 c) {
+    if (c >= 0x110000) return LB_AL;
+    return line_break_classes[line_break_blocks[c / UNICODE_BLOCK_SIZE]][c % UNICODE_BLOCK_SIZE];
+}
+
+int grapheme_break(Uint32 c) {
+    if (c >= 0x110000) return GB_OTHER;
+    return grapheme_break_classes[grapheme_break_blocks[c / UNICODE_BLOCK_SIZE]][c % UNICODE_BLOCK_SIZE];
+}
+
+// Scripts written without spaces, where any two characters may be broken
+static int is_ideographic(int lb) {
+    return lb == LB_ID || lb == LB_H2 || lb == LB_H3 || lb == LB_JL || lb == LB_JV || lb == LB_JT || lb == LB_CJ;
+}
+
+int can_break_between(Uint32 before, Uint32 after) {
+    if (before < 128 && after < 128) return 0;
+    int b = line_break_class(before);
+    int a = line_break_class(after);
+    if (b == LB_ZW) return 1;
+
+    switch (a) {
+        // Never at the start of a line, nor inside a cluster or after a joiner
+        case LB_CM: case LB_ZWJ: case LB_GL: case LB_WJ: case LB_CL: case LB_CP: case LB_EX: case LB_IS:
+        case LB_SY: case LB_NS: case LB_CJ: case LB_IN: case LB_QU: case LB_QU_PF: case LB_BA: case LB_HY:
+        case LB_SP: case LB_ZW:
+            return 0;
+    }
+    switch (b) {
+        // Never at the end of a line
+        case LB_ZWJ: case LB_GL: case LB_WJ: case LB_OP: case LB_QU: case LB_QU_PI: case LB_SP:
+            return 0;
+    }
+
+    if (b == LB_B2 || a == LB_B2) return b != a;
+    if (b == LB_BA || b == LB_HY) return 1;
+    // Hangul syllables are made of jamo that stay together
+    if (b == LB_JL && (a == LB_JL || a == LB_JV || a == LB_H2 || a == LB_H3)) return 0;
+    if ((b == LB_JV || b == LB_H2) && (a == LB_JV || a == LB_JT)) return 0;
+    if ((b == LB_JT || b == LB_H3) && a == LB_JT) return 0;
+    return is_ideographic(b) || is_ideographic(a);
+}
+
+void grapheme_state_reset(GraphemeState* state) {
+    state->prev = GB_CONTROL;
+    state->pictographic = 0;
+    state->regional = 0;
+}
+
+static int is_control(int gb) {
+    return gb == GB_CONTROL || gb == GB_CR || gb == GB_LF;
+}
+
+int grapheme_boundary(GraphemeState* state, Uint32 c) {
+    int gb = grapheme_break(c);
+    int prev = state->prev;
+    int boundary = 1;
+
+    if (prev == GB_CR && gb == GB_LF) boundary = 0;
+    else if (is_control(prev) || is_control(gb)) boundary = 1;
+    else if (prev == GB_L && (gb == GB_L || gb == GB_V || gb == GB_LV || gb == GB_LVT)) boundary = 0;
+    else if ((prev == GB_LV || prev == GB_V) && (gb == GB_V || gb == GB_T)) boundary = 0;
+    else if ((prev == GB_LVT || prev == GB_T) && gb == GB_T) boundary = 0;
+    else if (gb == GB_EXTEND || gb == GB_ZWJ || gb == GB_SPACING_MARK || prev == GB_PREPEND) boundary = 0;
+    // Emoji joined into one, and flags made of two regional indicators
+    else if (prev == GB_ZWJ && gb == GB_EXTENDED_PICTOGRAPHIC && state->pictographic) boundary = 0;
+    else if (prev == GB_REGIONAL_INDICATOR && gb == GB_REGIONAL_INDICATOR && state->regional % 2 == 1) boundary = 0;
+
+    if (gb == GB_EXTENDED_PICTOGRAPHIC) state->pictographic = 1;
+    else if (gb != GB_EXTEND && gb != GB_ZWJ) state->pictographic = 0;
+    state->regional = gb == GB_REGIONAL_INDICATOR ? state->regional + 1 : 0;
+    state->prev = (Uint8)gb;
+    return boundary;
+}
+
+size_t utf8_cluster_length(const char* text, size_t length) {
+    GraphemeState state;
+    grapheme_state_reset(&state);
+    size_t pos = 0;
+    while (pos < length) {
+        Uint32 c;
+        size_t char_length = utf8_decode32(text + pos, length - pos, &c);
+        if (grapheme_boundary(&state, c) && pos > 0) break;
+        pos += char_length;
+    }
+    return pos;
+}
@@ -0,0 +1,40 @@
+/* line_break.h */
+#ifndef LINE_BREAK_H
+#define LINE_BREAK_H
+
+#include <stddef.h>
+#include <SDL/SDL.h>
+
+/* Where the grapheme clusters of a run of text start, see grapheme_boundary */
+typedef struct {
+    Uint8 prev;                  // GraphemeBreak of the last character
+    Uint8 pictographic;          // Inside Extended_Pictographic Extend* ZWJ?
+    int regional;                // Regional indicators in a row up to the last character
+} GraphemeState;
+
+/* Class of a code point in the generated tables, see unicode_tables.h */
+int line_break_class(Uint32 c);
+int grapheme_break(Uint32 c);
+
+/* Whether a line may be broken between two characters without a space,
+ * by the UAX #14 classes: next to ideographs, kana and hangul, after
+ * hyphens and zero width spaces, but never before closing punctuation,
+ * small kana or combining marks, after opening punctuation (kinsoku
+ * shori) or next to non-breaking spaces and joiners. Two ASCII
+ * characters are left to the spaces, which the caller handles.
+ */
+int can_break_between(Uint32 before, Uint32 after);
+
+void grapheme_state_reset(GraphemeState* state);
+
+/* Whether a grapheme cluster (UAX #29) starts at c, the character after
+ * those passed to state before. Always true for the first character.
+ */
+int grapheme_boundary(GraphemeState* state, Uint32 c);
+
+/* Bytes of the grapheme cluster at the start of text, at least 1 when
+ * length > 0, so a base character keeps its combining marks
+ */
+size_t utf8_cluster_length(const char* text, size_t length);
+
+#endif
@@ -5,6 +5,7 @@
 #include <SDL/SDL.h>
 #include <SDL/SDL_ttf.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -12,10 +13,14 @@
 #include <sys/time.h>
 #include "font_loader.h"
 #include "font_data.h"
+#include "glyph_cache.h"
+#include "layout.h"
+#include "layout_cache.h"
+#include "layout_pool.h"
+#include "text_index.h"
 
-#define DEFAULT_BLOCKSIZE 50
 #define MARGINS 4
-#define SETTINGS_FILE_VERSION 4
+#define SETTINGS_FILE_VERSION 7
 #define DEFAULT_FONT_SIZE 12
 #define DEFAULT_WIDTH 240
 #define DEFAULT_HEIGHT 240
@@ -23,6 +28,10 @@
 #define DEFAULT_FONT "./fonts/DejaVuSansMono.ttf"
 #define SETTINGS_DIR ".txtview"
 #define SETTINGS_FILE "positions_v2.bin"
+#define SPARSE_LAYOUT_BYTES (256 * 1024 * 1024)
+#define RESIZE_DELAY_MS 250
+#define COLUMN_GAP 16
+#define MIN_COLUMN_WIDTH 160
 
 #ifndef MAX_PATH
     #define MAX_PATH 1024
@@ -32,38 +41,14 @@
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 
-// Make block size configurable
+// Scroll position as a text offset in the first visible line and how
+// many pixels of that line are scrolled out of view. The ignore
+// linebreaks view keeps the offsets of the text, so one anchor serves
+// both modes and every font size
 typedef struct {
-    size_t block_size;
-    struct timeval start_time;
-    struct timeval end_time;
-    long memory_used;
-    int total_blocks;
-} LayoutStats;
-
-typedef struct {
-    int y_position;          // Vertical position of this line
-    int height;             // Height of this line
-    int line_start_offset;  // Offset in the source text where this line starts
-    int line_length;        // Length of this line in characters
-    int is_wrapped;         // Whether this line was wrapped (split due to width)
-} LineInfo;
-
-typedef struct LineBlock {
-    struct LineBlock* next;
-    LineInfo lines[];  // Flexible array member
-} LineBlock;
-
-typedef struct {
-    LineBlock* first_block;
-    LineBlock* current_block;
-    size_t current_block_used;
-    int total_lines;
-    int last_calculated_width;
-    int calculated_total_height;
-    size_t block_size;           // Configurable block size
-    LayoutStats stats;           // Stats for this layout
-} TextLayout;
+    size_t offset;
+    int pixel;
+} ScrollAnchor;
 
 // Struct to store file scroll position
 typedef struct {
@@ -71,19 +56,22 @@ typedef struct {
     char filename[MAX_PATH];  // Full path of the file
     char font_path[MAX_PATH]; // Path to the font used
     int font_size;            // Font size when position was saved
-    int scroll_position;      // Saved scroll position
-    int scroll_position_adjusted;
+    Uint64 scroll_offset;     // Text offset of the first visible line
     int ignore_linebreaks;
     int inverted_colors;
+    int no_wrap;
 } FileScrollPosition;
 
 typedef struct {
     char* text;              // Dynamically allocated text
-    char* adjustested_text;
     size_t length;           // Length of text
-    int scroll_position;
-    int scroll_position_adjusted;
+    int ascii_only;          // Every byte is 7-bit ASCII, laid out and drawn without UTF-8 decoding
+    Uint64 file_size;        // Size and modification time of the file,
+    Sint64 file_mtime;       // saved layouts are only valid for these
+    char encoding[32];
+    ScrollAnchor scroll_anchor;
     TTF_Font* font;
+    GlyphCache* glyphs;          // Advance table for font at font_size
     int font_size;
     SDL_Color text_color;
     SDL_Color bg_color;
@@ -93,9 +81,29 @@ typedef struct {
     char settings_path[MAX_PATH];
     char font_path[MAX_PATH];
     int ignore_linebreaks;
+    int no_wrap;                 // One line per line of the text, scrolled sideways
+    int scroll_x;                // Pixels the lines are scrolled to the left when not wrapped
+    int widest_line;             // Widest line in the window without wrapping, up to past scroll_x, bounds it
     int inverted_colors;
-    TextLayout normal_layout;    // Layout info for normal text
-    TextLayout adjusted_layout;  // Layout info for text with ignored linebreaks
+    int showing_progress;        // Layout progress is drawn and needs updates
+    Uint32 page_shown_until;     // The page number is drawn until then after paging
+    char* line_buffer;           // Line being rendered, terminated for SDL_ttf
+    size_t line_buffer_size;
+    Uint16* unicode_buffer;      // The line as UCS-2 when the text is ASCII
+    size_t unicode_buffer_size;
+    TextLayout* normal_layout;   // Layout info for normal text
+    TextLayout* adjusted_layout; // Layout info for text with ignored linebreaks
+    TextLayout* nowrap_layout;   // Lines of the text without wrapping, the same for every font and width
+    LayoutPool layout_pool;      // Owns the layouts of every size laid out so far
+    int prefetched_size;         // Font size the neighbouring sizes were laid out for
+    ParagraphMemo* memo;         // Line breaks of paragraphs laid out before, kept across reloads
+    int sparse_layout;           // Keep checkpoints instead of lines, also for texts over SPARSE_LAYOUT_BYTES
+    int sliced_layout;           // Lay out in the main loop, a worker would only compete with it on one core
+    int columns;                 // Columns of wrapped lines side by side, a page spreads over all of them
+    TextIndex text_index;        // Paragraph and chapter starts, built when the text is loaded
+    char heading_pattern[256];   // Lines matching it are chapters too
+    int toc_open;                // The chapter list is shown instead of the text
+    int toc_selected;
 } TextViewer;
 
 // Configuration structure
@@ -107,17 +115,11 @@ typedef struct {
     char encoding[32];
     int ignore_linebreaks;
     int inverted_colors;
+    int sparse_layout;
+    int columns;
+    char heading_pattern[256];
 } ViewerConfig;
 
-typedef struct {
-    unsigned long text_hash;
-    size_t text_length;
-    int window_width;
-    int font_size;
-    int cached_height;
-    int in_use;  // Flag to indicate if this cache slot is occupied
-} HeightCache;
-
 typedef struct {
     char message[1024];
     Uint32 stop_display_time;
@@ -133,24 +135,50 @@ DisplayMessageData message_data;
 
 // Function prototypes
 char* resolve_path(const char* path);
-int utf8_char_length(const char* str);
 void print_usage(const char* program_name);
 void save_scroll_position(TextViewer* viewer);
 int load_scroll_position(TextViewer* viewer);
 void ensure_settings_dir(const char* settings_path);
 void destroy_viewer(TextViewer* viewer);
 void change_font_size(TextViewer* viewer, int new_size);
+void change_window_width(TextViewer* viewer, int width);
 int load_text_file(TextViewer* viewer, const char* filename, const char* encoding);
 void render_text(TextViewer* viewer, SDL_Surface* screen);
 char* convert_to_utf8(const char* input, size_t input_len, const char* from_encoding);
 int is_ttf_file(const char* filename);
 TextViewer* create_viewer(const char* settings_path, const char* font_path, int font_size, int width, int height, 
     SDL_Color text_color, SDL_Color bg_color, int ignore_linebreaks, int inverted_colors);
+void get_layout_source(TextViewer* viewer, int ignore_linebreaks, LayoutSource* source);
+void get_active_view(TextViewer* viewer, TextLayout** layout, ScrollAnchor** anchor, LayoutSource* source);
+void get_nowrap_view(TextViewer* viewer, TextLayout** layout, LayoutSource* source);
+void get_layout_cache_key(TextViewer* viewer, int ignore_linebreaks, LayoutCacheKey* key);
+void get_layout_cache_dir(TextViewer* viewer, char* settings_dir);
+void pick_layout(TextViewer* viewer, int mode);
+void reset_layouts(TextViewer* viewer);
+int use_sparse_layout(TextViewer* viewer);
+void prefetch_layouts(TextViewer* viewer);
+int step_layouts(TextViewer* viewer);
+void run_layout_benchmark(TextViewer* viewer);
 void enforce_scroll_boundaries(TextViewer* viewer);
-void calculate_text_layout(TextViewer* viewer, TextLayout* layout, const char* text);
-void free_text_layout(TextLayout* layout);
-void init_text_layout(TextLayout* layout, size_t block_size);
-int ensure_layout_capacity(TextLayout* layout);
+void scroll_viewer(TextViewer* viewer, int pixels);
+void scroll_viewer_x(TextViewer* viewer, int pixels);
+void scroll_to_start(TextViewer* viewer);
+void scroll_to_end(TextViewer* viewer);
+int get_column_count(TextViewer* viewer);
+int get_column_width(TextViewer* viewer, int columns);
+int get_shown_columns(TextViewer* viewer, const LayoutSource* source);
+int get_lines_per_page(TextViewer* viewer, const LayoutSource* source);
+int get_view_height(TextViewer* viewer, const LayoutSource* source);
+void scroll_page(TextViewer* viewer, int direction);
+void scroll_to_page(TextViewer* viewer, int page);
+void scroll_to_percent(TextViewer* viewer, int percent);
+void show_page_number(TextViewer* viewer);
+void scroll_to_offset(TextViewer* viewer, size_t offset);
+void jump_paragraph(TextViewer* viewer, int direction);
+void jump_chapter(TextViewer* viewer, int direction);
+void open_table_of_contents(TextViewer* viewer);
+void handle_table_of_contents_key(TextViewer* viewer, SDLKey key);
+void draw_table_of_contents(TextViewer* viewer, SDL_Surface* screen, SDL_Color fg, SDL_Color bg);
 void display_message(char* message, Uint32 display_time, int x, int y, int padding, SDL_Color fg, SDL_Color bg);
 void draw_display_message(SDL_Surface *destSurface);
 void stop_display_message();
@@ -194,187 +222,6 @@ void draw_display_message(SDL_Surface *destSurface)
     }
 }
 
-// Function to start timing
-void start_timing(LayoutStats* stats) {
-    gettimeofday(&stats->start_time, NULL);
-    stats->memory_used = 0;
-    stats->total_blocks = 0;
-}
-
-// Function to end timing
-void end_timing(LayoutStats* stats) {
-    gettimeofday(&stats->end_time, NULL);
-}
-
-// Function to get elapsed milliseconds
-long get_elapsed_ms(LayoutStats* stats) {
-    long seconds = stats->end_time.tv_sec - stats->start_time.tv_sec;
-    long microseconds = stats->end_time.tv_usec - stats->start_time.tv_usec;
-    return seconds * 1000 + microseconds / 1000;
-}
-
-// Corrected initialization
-void init_text_layout(TextLayout* layout, size_t block_size) {
-    layout->block_size = block_size;
-    size_t alloc_size = sizeof(LineBlock) + (block_size * sizeof(LineInfo));
-    layout->first_block = malloc(alloc_size);
-    
-    if (layout->first_block) {
-        layout->first_block->next = NULL;
-        layout->current_block = layout->first_block;
-        layout->current_block_used = 0;
-        layout->total_lines = 0;
-        layout->last_calculated_width = 0;
-        layout->calculated_total_height = 0;
-        layout->stats.block_size = block_size;
-        layout->stats.memory_used = alloc_size;
-        layout->stats.total_blocks = 1;
-    } else {
-        memset(layout, 0, sizeof(TextLayout));
-    }
-}
-
-// Corrected block allocation
-int ensure_layout_capacity(TextLayout* layout) {
-    if (layout->current_block == NULL || 
-        layout->current_block_used >= layout->block_size) {
-        // Need new block
-        size_t alloc_size = sizeof(LineBlock) + (layout->block_size * sizeof(LineInfo));
-        LineBlock* new_block = malloc(alloc_size);
-        if (!new_block) {
-            return 0;  // Allocation failed
-        }
-        new_block->next = NULL;
-        
-        if (layout->current_block) {
-            layout->current_block->next = new_block;
-        } else {
-            layout->first_block = new_block;
-        }
-        
-        layout->current_block = new_block;
-        layout->current_block_used = 0;
-        layout->stats.memory_used += alloc_size;
-        layout->stats.total_blocks++;
-    }
-    return 1;
-}
-
-// Helper function to get a line from the layout
-LineInfo* get_line_from_layout(TextLayout* layout, int index) {
-    if (index < 0 || index >= layout->total_lines) return NULL;
-    
-    int block_index = index / layout->block_size;
-    int line_index = index % layout->block_size;
-    
-    LineBlock* block = layout->first_block;
-    for (int i = 0; i < block_index && block; i++) {
-        block = block->next;
-    }
-    
-    if (!block) return NULL;
-    return &block->lines[line_index];
-}
-
-// Clean up function
-void free_text_layout(TextLayout* layout) {
-    LineBlock* block = layout->first_block;
-    while (block) {
-        LineBlock* next = block->next;
-        free(block);
-        block = next;
-    }
-    memset(layout, 0, sizeof(TextLayout));
-}
-size_t find_fitting_text_length(TTF_Font* font, const char* text, size_t max_length, int max_width) {
-    if (!font || !text || max_length == 0) return 0;
-    
-    char measure_buffer[max_length+1];
-    size_t left = 0;
-    size_t right = max_length;
-    size_t best_fit = 0;
-    
-    while (left <= right && right <= max_length) {
-        size_t mid = left + (right - left) / 2;
-        
-        // Safely copy text portion for measurement
-        if (mid >= sizeof(measure_buffer)) {
-            // If midpoint would exceed our buffer, use maximum safe length
-            mid = sizeof(measure_buffer) - 1;
-        }
-        
-        memset(measure_buffer, 0, sizeof(measure_buffer));
-        memcpy(measure_buffer, text, mid);
-        measure_buffer[mid] = '\0';
-        
-        int width = 0;
-        if (TTF_SizeUTF8(font, measure_buffer, &width, NULL) == 0) {
-            if (width <= max_width) {
-                best_fit = mid;
-                // If we're at max safe buffer size, no point trying larger
-                if (mid == sizeof(measure_buffer) - 1) break;
-                left = mid + 1;
-            } else {
-                if (mid == 0) break;
-                right = mid - 1;
-            }
-        } else {
-            // If TTF_SizeUTF8 fails, try with a smaller chunk
-            right = mid - 1;
-        }
-    }
-    
-    // If we found a fit, try to break at the last space for word wrapping
-    if (best_fit > 0 && best_fit < max_length) {
-        size_t space_pos = best_fit;
-        while (space_pos > 0) {
-            if (text[space_pos] == ' ') {
-                // Verify this shorter length still fits
-                memset(measure_buffer, 0, sizeof(measure_buffer));
-                memcpy(measure_buffer, text, space_pos);
-                measure_buffer[space_pos] = '\0';
-                
-                int width = 0;
-                if (TTF_SizeUTF8(font, measure_buffer, &width, NULL) == 0 && 
-                    width <= max_width) {
-                    best_fit = space_pos;
-                    break;
-                }
-            }
-            space_pos--;
-        }
-    }
-    
-    return best_fit;
-}
-
-// Add line to current block, allocate new block if needed
-LineInfo* add_line_to_layout(TextLayout* layout) {
-    if (layout->current_block_used >= layout->block_size) {
-        // Allocate block with space for LineInfo array
-        size_t alloc_size = sizeof(LineBlock) + (layout->block_size * sizeof(LineInfo));
-        LineBlock* new_block = malloc(alloc_size);
-        if (!new_block) return NULL;
-        
-        new_block->next = NULL;
-        
-        if (layout->current_block) {
-            layout->current_block->next = new_block;
-        } else {
-            layout->first_block = new_block;
-        }
-        
-        layout->current_block = new_block;
-        layout->current_block_used = 0;
-        layout->stats.memory_used += alloc_size;
-        layout->stats.total_blocks++;
-    }
-    
-    LineInfo* line = &layout->current_block->lines[layout->current_block_used++];
-    layout->total_lines++;
-    return line;
-}
-
 void ensure_settings_dir(const char* settings_path) {
     // Try to create directory
     #ifdef _WIN32
@@ -388,100 +235,19 @@ void ensure_settings_dir(const char* settings_path) {
     }
 }
 
-void calculate_text_layout(TextViewer* viewer, TextLayout* layout, const char* text) {
-    if (!text || !layout->first_block) return;
-    
-    // Reset layout
-    layout->current_block = layout->first_block;
-    layout->current_block_used = 0;
-    layout->total_lines = 0;
-    layout->last_calculated_width = viewer->window_width;
-    layout->calculated_total_height = 0;
-
-    const char* text_ptr = text;
-    int current_y = 0;
-    int line_height = (int)(viewer->font_size * LINE_SPACING);
-    int max_width = viewer->window_width - 2*MARGINS;
-
-    while (text_ptr && *text_ptr) {
-        const char* line_end = text_ptr;
-        size_t line_length = 0;
-        
-        // Find end of current line
-        while (*line_end && *line_end != '\n' && *line_end != '\r') {
-            line_end++;
-            line_length++;
-        }
-
-        if (line_length > 0) {
-            size_t start = 0;
-            while (start < line_length) {
-                // Find how much text fits using binary search
-                size_t chars_that_fit = find_fitting_text_length(viewer->font, 
-                    text_ptr + start, line_length - start, max_width);
-                
-                if (chars_that_fit == 0) {
-                    // Force at least one character if nothing fits
-                    chars_that_fit = utf8_char_length(text_ptr + start);
-                }
-
-                // Add line to layout
-                LineInfo* line = add_line_to_layout(layout);
-                if (!line) {
-                    printf("Failed to add line to layout\n");
-                    return;
-                }
-
-                line->y_position = current_y;
-                line->height = line_height;
-                line->line_start_offset = text_ptr + start - text;
-                line->line_length = chars_that_fit;
-                line->is_wrapped = (start + chars_that_fit < line_length);
-                
-                current_y += line_height;
-
-                start += chars_that_fit;
-                // Skip whitespace at start of next line
-                while (start < line_length && (text_ptr[start] == ' ' || text_ptr[start] == '\t')) {
-                    start++;
-                }
-            }
-        } else {
-            // Empty line
-            LineInfo* line = add_line_to_layout(layout);
-            if (!line) {
-                printf("Failed to add empty line to layout\n");
-                return;
-            }
-
-            line->y_position = current_y;
-            line->height = line_height;
-            line->line_start_offset = text_ptr - text;
-            line->line_length = 0;
-            line->is_wrapped = 0;
-            
-            current_y += line_height;
-        }
-
-        // Move to next line
-        text_ptr = line_end;
-        if (*text_ptr == '\r' && *(text_ptr + 1) == '\n') text_ptr += 2;
-        else if (*text_ptr == '\n' || *text_ptr == '\r') text_ptr++;
-    }
-
-    layout->calculated_total_height = current_y;
-}
-
 TextViewer* create_viewer(const char* settings_path, const char* font_path, int font_size, int width, int height, 
     SDL_Color text_color, SDL_Color bg_color, int ignore_linebreaks, int inverted_colors) {
     TextViewer* viewer = (TextViewer*)malloc(sizeof(TextViewer));
     if (!viewer) return NULL;
 
     viewer->text = NULL;  // Initialize text pointer to NULL
-    viewer->adjustested_text = NULL;
     viewer->length = 0;
-    viewer->scroll_position = 0;
-    viewer->scroll_position_adjusted = 0;
+    viewer->ascii_only = 0;
+    viewer->file_size = 0;
+    viewer->file_mtime = 0;
+    viewer->encoding[0] = '\0';
+    viewer->scroll_anchor.offset = 0;
+    viewer->scroll_anchor.pixel = 0;
     viewer->inverted_colors = 0;
     viewer->font_size = font_size;
     viewer->window_width = width;
@@ -491,11 +257,30 @@ TextViewer* create_viewer(const char* settings_path, const char* font_path, int
     viewer->current_file[0] = '\0';
     viewer->ignore_linebreaks = ignore_linebreaks;
     viewer->inverted_colors = inverted_colors;
-
+    viewer->showing_progress = 0;
+    viewer->page_shown_until = 0;
+    viewer->line_buffer = NULL;
+    viewer->line_buffer_size = 0;
+    viewer->unicode_buffer = NULL;
+    viewer->unicode_buffer_size = 0;
     
-    // Initialize layouts
-    init_text_layout(&viewer->normal_layout, DEFAULT_BLOCKSIZE);
-    init_text_layout(&viewer->adjusted_layout, DEFAULT_BLOCKSIZE);
+    // Layouts are picked from the pool once the text is loaded
+    viewer->normal_layout = NULL;
+    viewer->adjusted_layout = NULL;
+    viewer->nowrap_layout = NULL;
+    viewer->no_wrap = 0;
+    viewer->scroll_x = 0;
+    viewer->widest_line = 0;
+    init_layout_pool(&viewer->layout_pool, LAYOUT_POOL_MEMORY);
+    viewer->prefetched_size = 0;
+    viewer->memo = paragraph_memo_create();
+    viewer->sparse_layout = 0;
+    viewer->columns = 1;
+    init_text_index(&viewer->text_index);
+    viewer->heading_pattern[0] = '\0';
+    viewer->toc_open = 0;
+    viewer->toc_selected = 0;
+    viewer->sliced_layout = layout_thread_count() == 1;
 
     char* tmp = resolve_path(settings_path);
     memset(viewer->settings_path, 0, MAX_PATH);
@@ -508,13 +293,12 @@ TextViewer* create_viewer(const char* settings_path, const char* font_path, int
     free(tmp);
 
     viewer->font = TTF_OpenFont(viewer->font_path, font_size);
-    if (!viewer->font) 
+    viewer->glyphs = glyph_cache_create(viewer->font, font_size);
+    if (!viewer->font || !viewer->glyphs) 
     {
         printf("Failed to load font \"%s\": %s\n", viewer->font_path, TTF_GetError());
+        if (viewer->font) TTF_CloseFont(viewer->font);
         free(viewer->text);
-        free(viewer->adjustested_text);
-        free_text_layout(&viewer->normal_layout);
-        free_text_layout(&viewer->adjusted_layout);
         free(viewer);
         return NULL;
     }
@@ -586,10 +370,10 @@ void save_scroll_position(TextViewer* viewer) {
         memset(new_entry.font_path, 0, MAX_PATH);
         memcpy(new_entry.font_path, viewer->font_path, MAX_PATH - 1);
         
-        new_entry.scroll_position = viewer->scroll_position;
-        new_entry.scroll_position_adjusted = viewer->scroll_position_adjusted;
+        new_entry.scroll_offset = viewer->scroll_anchor.offset;
         new_entry.inverted_colors = viewer->inverted_colors;
         new_entry.ignore_linebreaks = viewer->ignore_linebreaks;
+        new_entry.no_wrap = viewer->no_wrap;
         new_entry.font_size = viewer->font_size;
         
         fwrite(&new_entry, sizeof(FileScrollPosition), 1, settings_file);
@@ -627,10 +411,10 @@ void save_scroll_position(TextViewer* viewer) {
             memset(current_entry.font_path, 0, MAX_PATH);
             memcpy(current_entry.font_path, viewer->font_path, MAX_PATH - 1);
             
-            current_entry.scroll_position = viewer->scroll_position;
-            current_entry.scroll_position_adjusted = viewer->scroll_position_adjusted;
+            current_entry.scroll_offset = viewer->scroll_anchor.offset;
             current_entry.font_size = viewer->font_size;
             current_entry.ignore_linebreaks = viewer->ignore_linebreaks;
+            current_entry.no_wrap = viewer->no_wrap;
             current_entry.inverted_colors = viewer->inverted_colors;
             
             fwrite(&current_entry, sizeof(FileScrollPosition), 1, settings_file);
@@ -656,10 +440,10 @@ void save_scroll_position(TextViewer* viewer) {
         memset(new_entry.font_path, 0, MAX_PATH);
         memcpy(new_entry.font_path, viewer->font_path, MAX_PATH - 1);
         
-        new_entry.scroll_position = viewer->scroll_position;
-        new_entry.scroll_position_adjusted = viewer->scroll_position_adjusted;
+        new_entry.scroll_offset = viewer->scroll_anchor.offset;
         new_entry.font_size = viewer->font_size;
         new_entry.ignore_linebreaks = viewer->ignore_linebreaks;
+        new_entry.no_wrap = viewer->no_wrap;
         new_entry.inverted_colors = viewer->inverted_colors;
         
         fseek(settings_file, 0, SEEK_END);
@@ -670,8 +454,7 @@ void save_scroll_position(TextViewer* viewer) {
 }
 
 int load_scroll_position(TextViewer* viewer) {
-    viewer->scroll_position = 0;
-    viewer->scroll_position_adjusted = 0;
+    memset(&viewer->scroll_anchor, 0, sizeof(ScrollAnchor));
 
     FILE* settings_file = fopen(viewer->settings_path, "rb");
 
@@ -714,10 +497,12 @@ int load_scroll_position(TextViewer* viewer) {
                         TTF_CloseFont(viewer->font);                   
                     viewer->font = TTF_OpenFont(current_entry.font_path, current_entry.font_size);
                     viewer->font_size = current_entry.font_size;
+                    glyph_cache_destroy(viewer->glyphs);
+                    viewer->glyphs = glyph_cache_create(viewer->font, viewer->font_size);
                     //set scroll
-                    viewer->scroll_position = current_entry.scroll_position;
-                    viewer->scroll_position_adjusted = current_entry.scroll_position_adjusted;
+                    viewer->scroll_anchor.offset = current_entry.scroll_offset;
                     viewer->ignore_linebreaks = current_entry.ignore_linebreaks;
+                    viewer->no_wrap = current_entry.no_wrap;
                     viewer->inverted_colors = current_entry.inverted_colors;
                                 
                 //} else {
@@ -765,11 +550,17 @@ char* resolve_path(const char* path) {
 // Update destroy_viewer
 void destroy_viewer(TextViewer* viewer) {
     if (viewer) {
+        // Stops the layout workers before the text goes away
+        free_layout_pool(&viewer->layout_pool);
+        if (viewer->nowrap_layout) free_text_layout(viewer->nowrap_layout);
+        free(viewer->nowrap_layout);
+        paragraph_memo_destroy(viewer->memo);
         if (viewer->font) TTF_CloseFont(viewer->font);
+        glyph_cache_destroy(viewer->glyphs);
         if (viewer->text) free(viewer->text);
-        if (viewer->adjustested_text) free(viewer->adjustested_text);
-        free_text_layout(&viewer->normal_layout);
-        free_text_layout(&viewer->adjusted_layout);
+        free_text_index(&viewer->text_index);
+        free(viewer->line_buffer);
+        free(viewer->unicode_buffer);
         free(viewer);
     }
 }
@@ -780,44 +571,71 @@ void change_font_size(TextViewer* viewer, int new_size) {
     // Open new font
     TTF_Font* new_font = TTF_OpenFont(viewer->font_path, new_size);
     if (!new_font) return;
-
-    // Save old font position ratios
-    float scroll_ratio = 0.0f;
-    float scroll_ratio_adjusted = 0.0f;
-    
-    if (viewer->normal_layout.calculated_total_height > 0) {
-        scroll_ratio = (float)viewer->scroll_position / viewer->normal_layout.calculated_total_height;
-    }
-    if (viewer->adjusted_layout.calculated_total_height > 0) {
-        scroll_ratio_adjusted = (float)viewer->scroll_position_adjusted / viewer->adjusted_layout.calculated_total_height;
+    GlyphCache* new_glyphs = glyph_cache_create(new_font, new_size);
+    if (!new_glyphs) {
+        TTF_CloseFont(new_font);
+        return;
     }
 
+    int old_line_height = (int)(viewer->font_size * LINE_SPACING);
+
     // Close old font and set new font
     if (viewer->font) TTF_CloseFont(viewer->font);
+    glyph_cache_destroy(viewer->glyphs);
     viewer->font = new_font;
+    viewer->glyphs = new_glyphs;
     viewer->font_size = new_size;
 
-    // Force recalculation of both layouts
-    calculate_text_layout(viewer, &viewer->normal_layout, viewer->text);
-    calculate_text_layout(viewer, &viewer->adjusted_layout, viewer->adjustested_text);
+    // The displayed layout starts over in the background, the scroll anchor
+    // keeps pointing at the same text
+    reset_layouts(viewer);
 
-    // Restore scroll positions based on ratios
-    viewer->scroll_position = (int)(scroll_ratio * viewer->normal_layout.calculated_total_height);
-    viewer->scroll_position_adjusted = (int)(scroll_ratio_adjusted * viewer->adjusted_layout.calculated_total_height);
+    int line_height = (int)(new_size * LINE_SPACING);
+    viewer->scroll_anchor.pixel = viewer->scroll_anchor.pixel * line_height / old_line_height;
 
     // Enforce scroll boundaries
     enforce_scroll_boundaries(viewer);
 }
 
+// Lay the text out for a new window width. Paragraphs that fit on a line
+// at the old and the new width come from the memo without being measured
+void change_window_width(TextViewer* viewer, int width) {
+    if (width == viewer->window_width || width <= 2 * MARGINS) return;
+
+    viewer->window_width = width;
+    reset_layouts(viewer);
+    // The neighbouring font sizes were laid out for the old width
+    viewer->prefetched_size = 0;
+    enforce_scroll_boundaries(viewer);
+}
+
 // Modified load_text_file to handle different encodings
 int load_text_file(TextViewer* viewer, const char* filename, const char* encoding) {
     FILE* file = fopen(filename, "rb");
     if (!file) return 0;
 
-    // Determine file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
+    // Determine file size, ftell would stop at 2 GB where long is 32 bits.
+    // 32 bit glibc needs _FILE_OFFSET_BITS=64 for stat to report it at all
+#ifdef _WIN32
+    struct __stat64 file_stat;
+    if (_stat64(filename, &file_stat) != 0) {
+#else
+    struct stat file_stat;
+    if (stat(filename, &file_stat) != 0) {
+#endif
+        fclose(file);
+        return 0;
+    }
+    // The text and its terminator have to fit in memory
+    if ((Uint64)file_stat.st_size >= SIZE_MAX) {
+        printf("File too large to load: %s\n", filename);
+        fclose(file);
+        return 0;
+    }
+    size_t file_size = (size_t)file_stat.st_size;
+    viewer->file_size = file_stat.st_size;
+    viewer->file_mtime = file_stat.st_mtime;
+    snprintf(viewer->encoding, sizeof(viewer->encoding), "%s", encoding ? encoding : "");
 
     // Allocate buffer for original file contents dynamically
     char* original_text = malloc(file_size + 1);
@@ -834,10 +652,18 @@ int load_text_file(TextViewer* viewer, const char* filename, const char* encodin
     if (viewer->text) {
         free(viewer->text);
     }
+    if (viewer->nowrap_layout) {
+        free_text_layout(viewer->nowrap_layout);
+        free(viewer->nowrap_layout);
+        viewer->nowrap_layout = NULL;
+    }
 
-    // Convert to UTF-8
-    char* utf8_text = convert_to_utf8(original_text, read_len, encoding);
-    free(original_text);
+    // Convert to UTF-8, UTF-8 text is used as read instead of copied
+    char* utf8_text = original_text;
+    if (encoding && strcasecmp(encoding, "UTF-8") != 0 && strcasecmp(encoding, "UTF8") != 0) {
+        utf8_text = convert_to_utf8(original_text, read_len, encoding);
+        free(original_text);
+    }
 
     if (!utf8_text) {
         fclose(file);
@@ -847,32 +673,12 @@ int load_text_file(TextViewer* viewer, const char* filename, const char* encodin
     // Set viewer text to converted UTF-8
     viewer->text = utf8_text;
     viewer->length = strlen(utf8_text);
-
-    if(viewer->adjustested_text)
-        free(viewer->adjustested_text);
-    
-    viewer->adjustested_text = (char*)malloc(viewer->length + 1);
-
-    const char *text_ptr =  viewer->text;
-    char *adju_ptr = viewer->adjustested_text;
-
-    //create adjusted text without linebreaks
-    char last = '\0';
-    while(text_ptr && *text_ptr)
-    {
-        if((*text_ptr == '\n' || *text_ptr == '\r') && (*(text_ptr+1) == '\n' || *(text_ptr+1) == '\r'))
-            *adju_ptr = '\n';
-        else if (*text_ptr == '\n' || *text_ptr == '\r')
-            if(last != '\n')
-                *adju_ptr = ' ';
-            else
-                *adju_ptr = '\n';
-        else
-            *adju_ptr = *text_ptr;
-        last = *adju_ptr;
-        adju_ptr++;
-        text_ptr++;
+    viewer->ascii_only = is_ascii_text(viewer->text, viewer->length);
+    viewer->toc_open = 0;
+    if (!build_text_index(&viewer->text_index, viewer->text, viewer->length, viewer->heading_pattern)) {
+        printf("Failed to index paragraphs and chapters\n");
     }
+
     fclose(file);
 
     memset(viewer->current_file, 0, MAX_PATH);
@@ -883,46 +689,46 @@ int load_text_file(TextViewer* viewer, const char* filename, const char* encodin
     return 1;
 }
 
-// UTF-8 character length detection
-int utf8_char_length(const char* str) {
-    unsigned char first_byte = (unsigned char)str[0];
-    
-    if (first_byte < 0x80) return 1;  // ASCII character
-    if (first_byte >= 0xC0 && first_byte <= 0xDF) return 2;  // 2-byte sequence
-    if (first_byte >= 0xE0 && first_byte <= 0xEF) return 3;  // 3-byte sequence
-    if (first_byte >= 0xF0 && first_byte <= 0xF7) return 4;  // 4-byte sequence
-    
-    return 1;  // Fallback
-}
+// SDL_ttf 2.0 renders UCS-2, TTF_RenderUTF8 and TTF_RenderText convert
+// to it first. The bytes of an ASCII line already are its characters
+static SDL_Surface* render_line(TextViewer* viewer, size_t length, SDL_Color fg) {
+    if (!viewer->ascii_only) return TTF_RenderUTF8_Blended(viewer->font, viewer->line_buffer, fg);
 
+    if (length + 1 > viewer->unicode_buffer_size) {
+        Uint16* buffer = realloc(viewer->unicode_buffer, (length + 1) * sizeof(Uint16));
+        if (!buffer) return NULL;
+        viewer->unicode_buffer = buffer;
+        viewer->unicode_buffer_size = length + 1;
+    }
+    for (size_t i = 0; i <= length; i++) {
+        viewer->unicode_buffer[i] = (unsigned char)viewer->line_buffer[i];
+    }
+    return TTF_RenderUNICODE_Blended(viewer->font, viewer->unicode_buffer, fg);
+}
 
-int find_first_visible_line(TextLayout* layout, int scroll_pos) {
-    int left = 0;
-    int right = layout->total_lines - 1;
+// Furthest scroll_x goes, the end of the widest line at the right margin
+static int get_max_scroll_x(TextViewer* viewer) {
+    return MAX(0, viewer->widest_line - (viewer->window_width - 2 * MARGINS));
+}
 
-    while (left <= right) {
-        int mid = left + (right - left) / 2;
-        LineInfo* line = get_line_from_layout(layout, mid);
-        
-        if (!line) break;
-
-        // Check if this line is the first visible line
-        if (line->y_position + line->height > scroll_pos) {
-            // Check if previous line (if exists) is not visible
-            if (mid == 0 || 
-                get_line_from_layout(layout, mid-1)->y_position + 
-                get_line_from_layout(layout, mid-1)->height <= scroll_pos) {
-                return mid;
-            }
-            // Search in lower half
-            right = mid - 1;
-        } else {
-            // Search in upper half
-            left = mid + 1;
-        }
+// Width of the widest line in the window when the lines are not wrapped.
+// Each is measured no further than two windows past scroll_x, enough to
+// scroll on by, so a long line costs no more than a short one
+static int measure_shown_lines(TextViewer* viewer, TextLayout* layout, const LayoutSource* source,
+    const ScrollAnchor* anchor) {
+    int limit = viewer->scroll_x + 2 * viewer->window_width;
+    int widest = 0;
+    LineInfo line;
+    int has_line = layout_line_at(layout, source, anchor->offset, &line);
+    for (int y = -anchor->pixel; has_line && y < viewer->window_height; y += source->line_height) {
+        int width;
+        find_text_offset_at(source->glyphs, source->text + line.line_start_offset, line.line_length, limit, &width);
+        widest = MAX(widest, width);
+        LineInfo next;
+        has_line = layout_next_line(layout, source, &line, &next);
+        line = next;
     }
-
-    return 0;  // Default to first line if not found
+    return widest;
 }
 
 void render_text(TextViewer* viewer, SDL_Surface* screen) {
@@ -935,45 +741,109 @@ void render_text(TextViewer* viewer, SDL_Surface* screen) {
     }
 
     SDL_FillRect(screen, NULL, SDL_MapRGB(screen->format, bg.r, bg.g, bg.b));
+    if (viewer->toc_open) {
+        draw_table_of_contents(viewer, screen, fg, bg);
+        SDL_Flip(screen);
+        return;
+    }
    
-    TextLayout* layout = viewer->ignore_linebreaks ? 
-        &viewer->adjusted_layout : &viewer->normal_layout;
-    const char* text = viewer->ignore_linebreaks ? 
-        viewer->adjustested_text : viewer->text;
-    int scroll_pos = viewer->ignore_linebreaks ? 
-        viewer->scroll_position_adjusted : viewer->scroll_position;
-
-    // Find first visible line
-    int first_line = find_first_visible_line(layout, scroll_pos);
-    
-    // Render visible lines
-    for (int i = first_line; i < layout->total_lines; i++) {
-        LineInfo* line = get_line_from_layout(layout, i);
-        if (!line) break;
+    TextLayout* layout;
+    ScrollAnchor* anchor;
+    LayoutSource source;
+    get_active_view(viewer, &layout, &anchor, &source);
+
+    // A saved or scrolled offset past the widest line would leave the window empty
+    if (viewer->no_wrap) {
+        viewer->widest_line = measure_shown_lines(viewer, layout, &source, anchor);
+        viewer->scroll_x = MIN(viewer->scroll_x, get_max_scroll_x(viewer));
+    }
 
-        int screen_y = line->y_position - scroll_pos;
-        
-        // Stop if we're past visible area
-        if (screen_y >= viewer->window_height) break;
+    // Render visible lines, starting at the scroll anchor. With columns
+    // the lines run on at the top of the next one, whole lines only
+    int columns = get_shown_columns(viewer, &source);
+    int column = 0;
+    int column_x = 0;
+    LineInfo line;
+    int screen_y = columns > 1 ? 0 : -anchor->pixel;
+    int has_line = layout_line_at(layout, &source, anchor->offset, &line);
+    while (has_line) {
+        size_t start = line.line_start_offset;
+        size_t length = line.line_length;
+        int x = MARGINS + column_x;
+        if (viewer->no_wrap && length > 0) {
+            // Only the characters that reach into the window are drawn
+            int skipped_x, shown_x;
+            size_t skipped = find_text_offset_at(source.glyphs, source.text + start, length, viewer->scroll_x, &skipped_x);
+            start += skipped;
+            length -= skipped;
+            x = MARGINS + skipped_x - viewer->scroll_x;
+            size_t shown = find_text_offset_at(source.glyphs, source.text + start, length, viewer->window_width - x, &shown_x);
+            // And the one cut by the right edge
+            if (shown < length) shown += utf8_char_length(source.text + start + shown);
+            length = MIN(shown, length);
+        }
 
         // Render line if it has content
-        if (line->line_length > 0 && screen_y >= -line->height) {
-            char line_buffer[1024];
-            size_t buf_size = sizeof(line_buffer) - 1;
-            size_t copy_len = line->line_length;
-            if (copy_len > buf_size) {
-                copy_len = buf_size;
+        if (length > 0) {
+            // SDL_ttf wants a terminated string, the buffer grows to the longest line
+            if (length + 1 > viewer->line_buffer_size) {
+                char* buffer = realloc(viewer->line_buffer, length + 1);
+                if (!buffer) break;
+                viewer->line_buffer = buffer;
+                viewer->line_buffer_size = length + 1;
             }
-            memcpy(line_buffer, text + line->line_start_offset, copy_len);
-            line_buffer[copy_len] = '\0';
+            copy_source_text(&source, start, length, viewer->line_buffer);
+            viewer->line_buffer[length] = '\0';
 
-            SDL_Surface* text_surface = TTF_RenderUTF8_Blended(viewer->font, line_buffer, fg);
+            SDL_Surface* text_surface = render_line(viewer, length, fg);
             if (text_surface) {
-                SDL_Rect dest = {MARGINS, screen_y, 0, 0};
+                SDL_Rect dest = {x, screen_y, 0, 0};
                 SDL_BlitSurface(text_surface, NULL, screen, &dest);
                 SDL_FreeSurface(text_surface);
             }
         }
+
+        // Stop if we're past visible area
+        screen_y += source.line_height;
+        if (columns > 1 && screen_y + source.line_height > viewer->window_height) {
+            if (++column == columns) break;
+            column_x += source.max_width + COLUMN_GAP;
+            screen_y = 0;
+        } else if (screen_y >= viewer->window_height) {
+            break;
+        }
+
+        LineInfo next;
+        has_line = layout_next_line(layout, &source, &line, &next);
+        line = next;
+    }
+
+    // Show how far the background layout got until it is done
+    size_t laid_out;
+    viewer->showing_progress = layout_progress(layout, &laid_out);
+    if (viewer->showing_progress) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Layout %zu / %zu KB", laid_out / 1024, source.length / 1024);
+        display_message(msg, 1000, viewer->window_width >> 1, viewer->window_height - 16, 5, bg, fg);
+        draw_display_message(screen);
+    } else if (viewer->page_shown_until) {
+        // The page of the top line, the last one once the end of the text is shown
+        int per_page = get_lines_per_page(viewer, &source);
+        int index = layout_line_index(layout, &source, anchor->offset);
+        int pages = layout_page_count(layout, per_page);
+        if (index >= 0) {
+            char msg[64];
+            LineInfo below;
+            if (!pages) {
+                snprintf(msg, sizeof(msg), "Page %d", index / per_page + 1);
+            } else if (!get_line_from_layout(layout, &source, index + per_page, &below)) {
+                snprintf(msg, sizeof(msg), "Page %d of %d", pages, pages);
+            } else {
+                snprintf(msg, sizeof(msg), "Page %d of %d", index / per_page + 1, pages);
+            }
+            display_message(msg, 1000, viewer->window_width >> 1, viewer->window_height - 16, 5, bg, fg);
+            draw_display_message(screen);
+        }
     }
     SDL_Flip(screen);
 }
@@ -1052,6 +922,16 @@ int read_config(const char* config_path, ViewerConfig* config) {
         else if (strcmp(key, "inverted_colors") == 0) {
             config->inverted_colors = atoi(value);
         } 
+        else if (strcmp(key, "sparse_layout") == 0) {
+            config->sparse_layout = atoi(value);
+        }
+        else if (strcmp(key, "columns") == 0) {
+            config->columns = atoi(value);
+        }
+        else if (strcmp(key, "heading_pattern") == 0) {
+            strncpy(config->heading_pattern, value, sizeof(config->heading_pattern) - 1);
+            config->heading_pattern[sizeof(config->heading_pattern) - 1] = '\0';
+        }
         else if (strcmp(key, "font_size") == 0) {
             config->font_size = atoi(value);
         }
@@ -1072,7 +952,7 @@ int read_config(const char* config_path, ViewerConfig* config) {
 }
 
 void print_usage(const char* program_name) {
-    printf("Usage: %s <text_file> [-conf=path/to/config] [font_path] [font_size] [bg_r,g,b] [text_r,g,b] [encoding] [-ignore_linebreaks] [-inverted_colors]\n", program_name);
+    printf("Usage: %s <text_file> [-conf=path/to/config] [font_path] [font_size] [bg_r,g,b] [text_r,g,b] [encoding] [-ignore_linebreaks] [-inverted_colors] [-fullscreen] [-w=width] [-h=height] [-sparse_layout] [-columns=count] [-benchmark]\n", program_name);
     printf("  text_file: Path to the text file to display (required)\n");
     printf("  -conf=path: Optional configuration file path\n");
     printf("  font_path: Path to TTF font file\n");
@@ -1082,6 +962,12 @@ void print_usage(const char* program_name) {
     printf("  encoding: Text file encoding (e.g., UTF-8, ISO-8859-1)\n");
     printf("  -ignore_linebreaks: Default value for Ignore original line breaks and fill window width\n");
     printf("  -inverted_colors: Default value for inverted (switched bg & text color)\n");
+    printf("  -fullscreen: Display the viewer fullscreen\n");
+    printf("  -w=width: Use width for window width\n");
+    printf("  -h=height: Use height for window height\n");
+    printf("  -sparse_layout: Only keep a checkpoint every few paragraphs instead of every line, for huge files\n");
+    printf("  -columns=count: Wrap the text into count columns side by side where the window is wide enough\n");
+    printf("  -benchmark: Time laying out the text with 1, 2 and 4 threads and exit\n");
 }
 
 // Add a helper function to check if a file is likely a TTF font
@@ -1096,12 +982,612 @@ int is_ttf_file(const char* filename) {
     return (strcasecmp(dot, ".ttf") == 0);
 }
 
+void get_layout_source(TextViewer* viewer, int ignore_linebreaks, LayoutSource* source) {
+    source->text = viewer->text;
+    source->length = viewer->length;
+    source->glyphs = viewer->glyphs;
+    source->font_id = paragraph_hash(viewer->font_path, strlen(viewer->font_path));
+    source->max_width = get_column_width(viewer, get_column_count(viewer));
+    source->line_height = (int)(viewer->font_size * LINE_SPACING);
+    source->ignore_linebreaks = ignore_linebreaks;
+    source->no_wrap = 0;
+    source->ascii = viewer->ascii_only;
+    source->memo = viewer->memo;
+}
+
+// The lines of the text as they are, laid out on demand. They only
+// depend on the text, so the layout is kept until another is loaded
+void get_nowrap_view(TextViewer* viewer, TextLayout** layout, LayoutSource* source) {
+    get_layout_source(viewer, 0, source);
+    source->no_wrap = 1;
+    if (!viewer->nowrap_layout) {
+        viewer->nowrap_layout = malloc(sizeof(TextLayout));
+        if (viewer->nowrap_layout) {
+            init_text_layout(viewer->nowrap_layout, layout_block_size(viewer->length));
+            viewer->nowrap_layout->sparse = use_sparse_layout(viewer);
+        }
+    }
+    *layout = viewer->nowrap_layout;
+}
+
+// Layout, scroll anchor and source of the mode being displayed. A stale
+// layout is picked here, the first time its mode is shown
+void get_active_view(TextViewer* viewer, TextLayout** layout, ScrollAnchor** anchor, LayoutSource* source) {
+    if (viewer->no_wrap) {
+        get_nowrap_view(viewer, layout, source);
+        *anchor = &viewer->scroll_anchor;
+        return;
+    }
+    *layout = viewer->ignore_linebreaks ? viewer->adjusted_layout : viewer->normal_layout;
+    if (!*layout) {
+        pick_layout(viewer, viewer->ignore_linebreaks);
+        *layout = viewer->ignore_linebreaks ? viewer->adjusted_layout : viewer->normal_layout;
+    }
+    *anchor = &viewer->scroll_anchor;
+    get_layout_source(viewer, viewer->ignore_linebreaks, source);
+}
+
+// Saved layouts live next to the settings file
+void get_layout_cache_dir(TextViewer* viewer, char* settings_dir) {
+    snprintf(settings_dir, MAX_PATH, "%s", viewer->settings_path);
+    char* separator = strrchr(settings_dir, '/');
+    #ifdef _WIN32
+    if (strrchr(settings_dir, '\\') > separator) separator = strrchr(settings_dir, '\\');
+    #endif
+    if (separator) *separator = '\0';
+    else snprintf(settings_dir, MAX_PATH, ".");
+}
+
+// Huge texts only keep checkpoints, their lines would not fit in memory
+int use_sparse_layout(TextViewer* viewer) {
+    return viewer->sparse_layout || viewer->length >= SPARSE_LAYOUT_BYTES;
+}
+
+// Pick the layout of a mode for the current font size and width: from
+// the pool when it was laid out before, else from the layout cache, else
+// lay the text out again in the background
+void pick_layout(TextViewer* viewer, int mode) {
+    TextLayout** active = mode ? &viewer->adjusted_layout : &viewer->normal_layout;
+    LayoutSource source;
+    LayoutCacheKey key;
+    char settings_dir[MAX_PATH];
+    char cache_path[MAX_PATH];
+    get_layout_source(viewer, mode, &source);
+    get_layout_cache_key(viewer, mode, &key);
+    get_layout_cache_dir(viewer, settings_dir);
+    layout_cache_path(cache_path, MAX_PATH, settings_dir, &key);
+
+    PooledLayout* entry = layout_pool_find(&viewer->layout_pool, viewer->font_size, source.max_width, mode);
+    if (entry) {
+        // A layout done ahead becomes the saved one for this text, when
+        // its worker is still running as soon as that completes it
+        if (entry->speculative && layout_memory(&entry->layout) > 0 && !entry->layout.mapping) {
+            save_layout_when_complete(&entry->layout, cache_path, &key);
+            entry->speculative = 0;
+        }
+        *active = &entry->layout;
+        return;
+    }
+
+    // The layout of the other mode has to stay when there is one
+    TextLayout* keep = mode ? viewer->normal_layout : viewer->adjusted_layout;
+    entry = layout_pool_add(&viewer->layout_pool, viewer->font_size, source.max_width, mode,
+        layout_block_size(viewer->length), &keep, keep ? 1 : 0);
+    if (!entry) return;
+    *active = &entry->layout;
+    (*active)->sparse = use_sparse_layout(viewer);
+
+    // Reuse the layout from an earlier run, else lay out and save it
+    if (!load_layout_cache(*active, cache_path, &key)) {
+        if (viewer->sliced_layout) (*active)->sliced = 1;
+        else start_layout_worker(*active, &source, viewer->font_path, viewer->font_size, 0, cache_path, &key);
+    }
+}
+
+// Only the displayed mode is picked, the other one goes stale until it
+// is shown or the viewer has nothing else to do. Lines that are not
+// wrapped need neither
+void reset_layouts(TextViewer* viewer) {
+    viewer->normal_layout = NULL;
+    viewer->adjusted_layout = NULL;
+    if (!viewer->no_wrap) pick_layout(viewer, viewer->ignore_linebreaks);
+}
+
+// Once the displayed layout is done, lay out the other mode and then the
+// neighbouring font sizes in the background, so Y, A and B only have to
+// pick them from the pool
+void prefetch_layouts(TextViewer* viewer) {
+    if (viewer->no_wrap) return;
+    TextLayout* layout;
+    ScrollAnchor* anchor;
+    LayoutSource source;
+    get_active_view(viewer, &layout, &anchor, &source);
+
+    size_t laid_out;
+    if (!layout || layout_progress(layout, &laid_out)) return;
+    TextLayout* other = viewer->ignore_linebreaks ? viewer->normal_layout : viewer->adjusted_layout;
+    if (!other) {
+        pick_layout(viewer, !viewer->ignore_linebreaks);
+        return;
+    }
+    if (viewer->sliced_layout || layout_progress(other, &laid_out)) return;
+    if (viewer->prefetched_size == viewer->font_size) return;
+    viewer->prefetched_size = viewer->font_size;
+
+    TextLayout* keep[2] = { viewer->normal_layout, viewer->adjusted_layout };
+    for (int delta = 1; delta >= -1; delta -= 2) {
+        int font_size = viewer->font_size + delta;
+        if (font_size <= 0 ||
+            layout_pool_find(&viewer->layout_pool, font_size, source.max_width, viewer->ignore_linebreaks)) {
+            continue;
+        }
+
+        PooledLayout* entry = layout_pool_add(&viewer->layout_pool, font_size, source.max_width,
+            viewer->ignore_linebreaks, layout_block_size(viewer->length), keep, 2);
+        if (!entry) continue;
+
+        // The worker measures with its own fonts of that size
+        LayoutSource ahead = source;
+        ahead.glyphs = NULL;
+        ahead.line_height = (int)(font_size * LINE_SPACING);
+        entry->speculative = 1;
+        entry->layout.sparse = use_sparse_layout(viewer);
+        start_layout_worker(&entry->layout, &ahead, viewer->font_path, font_size, 0, NULL, NULL);
+    }
+}
+
+// Lay out a slice of the sliced layouts, the displayed one first, and
+// save the ones that got done. Returns 1 while there is more to do
+int step_layouts(TextViewer* viewer) {
+    for (int i = 0; i < 2; i++) {
+        int mode = i ? !viewer->ignore_linebreaks : viewer->ignore_linebreaks;
+        TextLayout* layout = mode ? viewer->adjusted_layout : viewer->normal_layout;
+        if (!layout || !layout->sliced || layout->complete) continue;
+
+        LayoutSource source;
+        get_layout_source(viewer, mode, &source);
+        if (step_text_layout(layout, &source, LAYOUT_SLICE_MS)) return 1;
+
+        char settings_dir[MAX_PATH];
+        char cache_path[MAX_PATH];
+        LayoutCacheKey key;
+        get_layout_cache_dir(viewer, settings_dir);
+        get_layout_cache_key(viewer, mode, &key);
+        layout_cache_path(cache_path, MAX_PATH, settings_dir, &key);
+        save_layout_cache(layout, cache_path, &key);
+        return 1;
+    }
+    return 0;
+}
+
+// Time a full layout of the loaded text with 1, 2 and 4 threads
+void run_layout_benchmark(TextViewer* viewer) {
+    static const int thread_counts[] = { 1, 2, 4 };
+    printf("Layout benchmark: %zu bytes%s, %d processors\n", viewer->length,
+        viewer->ascii_only ? " of ASCII" : "", layout_thread_count());
+
+    for (int mode = 0; mode < 2; mode++) {
+        LayoutSource source;
+        get_layout_source(viewer, mode, &source);
+        // Lay every paragraph out, the memo would hide the work after the first run
+        source.memo = NULL;
+        long single_ms = 0;
+
+        for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+            TextLayout layout;
+            init_text_layout(&layout, layout_block_size(viewer->length));
+            start_timing(&layout.stats);
+            if (start_layout_worker(&layout, &source, viewer->font_path, viewer->font_size, thread_counts[i], NULL, NULL)) {
+                wait_layout_worker(&layout);
+            } else {
+                extend_text_layout(&layout, &source, viewer->length);
+            }
+            end_timing(&layout.stats);
+
+            long ms = get_elapsed_ms(&layout.stats);
+            if (i == 0) single_ms = ms;
+            printf("  %s, %d thread%s: %ld ms, %d lines, %.2fx\n", mode ? "ignore linebreaks" : "normal",
+                thread_counts[i], thread_counts[i] > 1 ? "s" : "", ms, layout.total_lines,
+                ms > 0 ? (double)single_ms / ms : 1.0);
+            free_text_layout(&layout);
+        }
+
+        // Filling a fresh memo from every thread, the lookups and adds
+        // must not serialize the shards
+        long memo_single_ms = 0;
+        for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+            ParagraphMemo* memo = paragraph_memo_create();
+            if (!memo) break;
+            source.memo = memo;
+            TextLayout layout;
+            init_text_layout(&layout, layout_block_size(viewer->length));
+            start_timing(&layout.stats);
+            if (start_layout_worker(&layout, &source, viewer->font_path, viewer->font_size, thread_counts[i], NULL, NULL)) {
+                wait_layout_worker(&layout);
+            } else {
+                extend_text_layout(&layout, &source, viewer->length);
+            }
+            end_timing(&layout.stats);
+
+            long ms = get_elapsed_ms(&layout.stats);
+            if (i == 0) memo_single_ms = ms;
+            printf("  %s, %d thread%s filling the memo: %ld ms, %.2fx\n", mode ? "ignore linebreaks" : "normal",
+                thread_counts[i], thread_counts[i] > 1 ? "s" : "", ms,
+                ms > 0 ? (double)memo_single_ms / ms : 1.0);
+            free_text_layout(&layout);
+            paragraph_memo_destroy(memo);
+        }
+        source.memo = NULL;
+
+        // The ASCII kernel against the UTF-8 path it replaces, on one thread
+        if (viewer->ascii_only) {
+            long path_ms[2];
+            for (int ascii = 0; ascii < 2; ascii++) {
+                TextLayout layout;
+                init_text_layout(&layout, layout_block_size(viewer->length));
+                source.ascii = ascii;
+                start_timing(&layout.stats);
+                extend_text_layout(&layout, &source, viewer->length);
+                end_timing(&layout.stats);
+                path_ms[ascii] = get_elapsed_ms(&layout.stats);
+                printf("  %s, %s path: %ld ms, %d lines\n", mode ? "ignore linebreaks" : "normal",
+                    ascii ? "ASCII" : "UTF-8", path_ms[ascii], layout.total_lines);
+                free_text_layout(&layout);
+            }
+            if (path_ms[1] > 0) printf("  ASCII speedup: %.2fx\n", (double)path_ms[0] / path_ms[1]);
+        }
+
+        // A relayout of the same size, as after a font size round trip
+        if (viewer->memo) {
+            source.memo = viewer->memo;
+            for (int pass = 0; pass < 2; pass++) {
+                TextLayout layout;
+                init_text_layout(&layout, layout_block_size(viewer->length));
+                start_timing(&layout.stats);
+                extend_text_layout(&layout, &source, viewer->length);
+                end_timing(&layout.stats);
+                if (pass == 1) {
+                    printf("  %s, memoized relayout: %ld ms, %d lines\n", mode ? "ignore linebreaks" : "normal",
+                        get_elapsed_ms(&layout.stats), layout.total_lines);
+                }
+                free_text_layout(&layout);
+            }
+        }
+    }
+}
+
+void get_layout_cache_key(TextViewer* viewer, int ignore_linebreaks, LayoutCacheKey* key) {
+    LayoutSource source;
+    get_layout_source(viewer, ignore_linebreaks, &source);
+
+    // Compared with memcmp, so padding has to be zero too
+    memset(key, 0, sizeof(LayoutCacheKey));
+    snprintf(key->text_path, LAYOUT_PATH_MAX, "%s", viewer->current_file);
+    snprintf(key->font_path, LAYOUT_PATH_MAX, "%s", viewer->font_path);
+    snprintf(key->encoding, sizeof(key->encoding), "%s", viewer->encoding);
+    key->file_size = viewer->file_size;
+    key->file_mtime = viewer->file_mtime;
+    key->text_length = viewer->length;
+    key->font_size = viewer->font_size;
+    key->window_width = viewer->window_width;
+    key->margins = MARGINS;
+    key->line_spacing = (int)(LINE_SPACING * 1000.0f + 0.5f);
+    key->max_width = source.max_width;
+    key->line_height = source.line_height;
+    key->ignore_linebreaks = ignore_linebreaks;
+}
+
 void enforce_scroll_boundaries(TextViewer* viewer) {
-    int max_scroll = MAX(0, viewer->normal_layout.calculated_total_height - viewer->window_height);
-    int max_scroll_adjusted = MAX(0, viewer->adjusted_layout.calculated_total_height - viewer->window_height);
-    
-    viewer->scroll_position = MAX(0, MIN(viewer->scroll_position, max_scroll));
-    viewer->scroll_position_adjusted = MAX(0, MIN(viewer->scroll_position_adjusted, max_scroll_adjusted));
+    TextLayout* layout;
+    ScrollAnchor* anchor;
+    LayoutSource source;
+    get_active_view(viewer, &layout, &anchor, &source);
+
+    LineInfo line;
+    if (!layout_line_at(layout, &source, anchor->offset, &line)) {
+        anchor->offset = 0;
+        anchor->pixel = 0;
+        return;
+    }
+    // The offset is left inside its line, so toggling the mode or the
+    // font size back and forth returns to the very same line
+    if (anchor->offset > source.length) anchor->offset = line.line_start_offset;
+    anchor->pixel = MAX(0, MIN(anchor->pixel, source.line_height - 1));
+    if (get_shown_columns(viewer, &source) > 1) anchor->pixel = 0;
+
+    // The lines below the anchor have to fill the window, else show the last page
+    int covered = source.line_height - anchor->pixel;
+    int view_height = get_view_height(viewer, &source);
+    while (covered < view_height) {
+        LineInfo next;
+        if (!layout_next_line(layout, &source, &line, &next)) {
+            scroll_to_end(viewer);
+            return;
+        }
+        line = next;
+        covered += source.line_height;
+    }
+}
+
+void scroll_viewer(TextViewer* viewer, int pixels) {
+    TextLayout* layout;
+    ScrollAnchor* anchor;
+    LayoutSource source;
+    get_active_view(viewer, &layout, &anchor, &source);
+
+    LineInfo line;
+    if (!layout_line_at(layout, &source, anchor->offset, &line)) return;
+
+    // Columns only show whole lines, so move at least one
+    if (get_shown_columns(viewer, &source) > 1) {
+        int lines = (abs(pixels) + source.line_height - 1) / source.line_height;
+        pixels = pixels < 0 ? -lines * source.line_height : lines * source.line_height;
+    }
+
+    // Move the anchor line by line, only the lines passed are laid out
+    int pixel = anchor->pixel + pixels;
+    while (pixel >= source.line_height) {
+        LineInfo next;
+        if (!layout_next_line(layout, &source, &line, &next)) {
+            pixel = 0;
+            break;
+        }
+        line = next;
+        pixel -= source.line_height;
+    }
+    while (pixel < 0) {
+        LineInfo prev;
+        if (!layout_prev_line(layout, &source, &line, &prev)) {
+            pixel = 0;
+            break;
+        }
+        line = prev;
+        pixel += source.line_height;
+    }
+
+    anchor->offset = line.line_start_offset;
+    anchor->pixel = pixel;
+    enforce_scroll_boundaries(viewer);
+}
+
+// Scroll the lines sideways, only when they are not wrapped, up to the
+// end of the widest line drawn last
+void scroll_viewer_x(TextViewer* viewer, int pixels) {
+    if (!viewer->no_wrap) return;
+    viewer->scroll_x = MAX(0, MIN(viewer->scroll_x + pixels, get_max_scroll_x(viewer)));
+}
+
+void scroll_to_start(TextViewer* viewer) {
+    ScrollAnchor* anchor = &viewer->scroll_anchor;
+    anchor->offset = 0;
+    anchor->pixel = 0;
+}
+
+void scroll_to_end(TextViewer* viewer) {
+    TextLayout* layout;
+    ScrollAnchor* anchor;
+    LayoutSource source;
+    get_active_view(viewer, &layout, &anchor, &source);
+
+    // Lay out backwards from the last line until the window is filled
+    LineInfo line;
+    if (!layout_line_at(layout, &source, source.length, &line)) return;
+
+    int covered = source.line_height;
+    int view_height = get_view_height(viewer, &source);
+    while (covered < view_height) {
+        LineInfo prev;
+        if (!layout_prev_line(layout, &source, &line, &prev)) break;
+        line = prev;
+        covered += source.line_height;
+    }
+
+    anchor->offset = line.line_start_offset;
+    anchor->pixel = MAX(0, covered - view_height);
+}
+
+// As many of the configured columns as are at least MIN_COLUMN_WIDTH wide
+int get_column_count(TextViewer* viewer) {
+    int columns = MAX(1, viewer->columns);
+    while (columns > 1 && get_column_width(viewer, columns) < MIN_COLUMN_WIDTH) columns--;
+    return columns;
+}
+
+int get_column_width(TextViewer* viewer, int columns) {
+    return (viewer->window_width - 2*MARGINS - (columns - 1) * COLUMN_GAP) / columns;
+}
+
+// Lines that are not wrapped are shown in one column
+int get_shown_columns(TextViewer* viewer, const LayoutSource* source) {
+    return source->no_wrap ? 1 : get_column_count(viewer);
+}
+
+// Whole lines that fit in the window, a page of text spread over the columns
+int get_lines_per_page(TextViewer* viewer, const LayoutSource* source) {
+    return MAX(1, viewer->window_height / source->line_height) * get_shown_columns(viewer, source);
+}
+
+// Height the lines of a page would take in one column
+int get_view_height(TextViewer* viewer, const LayoutSource* source) {
+    if (get_shown_columns(viewer, source) == 1) return viewer->window_height;
+    return get_lines_per_page(viewer, source) * source->line_height;
+}
+
+// Page to the first line of the next page, or back to the first line of the
+// current one unless the window already starts there
+void scroll_page(TextViewer* viewer, int direction) {
+    TextLayout* layout;
+    ScrollAnchor* anchor;
+    LayoutSource source;
+    get_active_view(viewer, &layout, &anchor, &source);
+
+    int per_page = get_lines_per_page(viewer, &source);
+    int page = layout_page_at(layout, &source, anchor->offset, per_page);
+    LineInfo line;
+    if (page >= 0) {
+        if (direction > 0) {
+            page++;
+        } else if (anchor->pixel == 0 && layout_page_start(layout, &source, page, per_page, &line) &&
+                   line.line_start_offset == anchor->offset) {
+            page--;
+        }
+        if (layout_page_start(layout, &source, page, per_page, &line)) {
+            anchor->offset = line.line_start_offset;
+            anchor->pixel = 0;
+            enforce_scroll_boundaries(viewer);
+            return;
+        }
+        if (page < 0) return;
+    }
+
+    // Past the laid out prefix, page by whole lines from the anchor line
+    if (!layout_line_at(layout, &source, anchor->offset, &line)) return;
+    for (int i = 0; i < per_page; i++) {
+        LineInfo step;
+        int moved = direction > 0 ? layout_next_line(layout, &source, &line, &step)
+                                  : layout_prev_line(layout, &source, &line, &step);
+        if (!moved) break;
+        line = step;
+    }
+    anchor->offset = line.line_start_offset;
+    anchor->pixel = 0;
+    enforce_scroll_boundaries(viewer);
+}
+
+void scroll_to_page(TextViewer* viewer, int page) {
+    TextLayout* layout;
+    ScrollAnchor* anchor;
+    LayoutSource source;
+    get_active_view(viewer, &layout, &anchor, &source);
+
+    LineInfo line;
+    if (!layout_page_start(layout, &source, page, get_lines_per_page(viewer, &source), &line)) return;
+    anchor->offset = line.line_start_offset;
+    anchor->pixel = 0;
+    enforce_scroll_boundaries(viewer);
+}
+
+// Jump to a page once the page count is known, else to the line at that
+// share of the bytes
+void scroll_to_percent(TextViewer* viewer, int percent) {
+    TextLayout* layout;
+    ScrollAnchor* anchor;
+    LayoutSource source;
+    get_active_view(viewer, &layout, &anchor, &source);
+
+    int pages = layout_page_count(layout, get_lines_per_page(viewer, &source));
+    if (pages) {
+        scroll_to_page(viewer, MIN(pages - 1, (int)((long long)pages * percent / 100)));
+        return;
+    }
+
+    LineInfo line;
+    if (!layout_line_at(layout, &source, (size_t)((double)source.length * percent / 100), &line)) return;
+    anchor->offset = line.line_start_offset;
+    anchor->pixel = 0;
+    enforce_scroll_boundaries(viewer);
+}
+
+void show_page_number(TextViewer* viewer) {
+    viewer->page_shown_until = SDL_GetTicks() + 1000;
+}
+
+// Show the text from offset on, for jumps to paragraphs and chapters
+void scroll_to_offset(TextViewer* viewer, size_t offset) {
+    ScrollAnchor* anchor = &viewer->scroll_anchor;
+    anchor->offset = offset;
+    anchor->pixel = 0;
+    enforce_scroll_boundaries(viewer);
+}
+
+void jump_paragraph(TextViewer* viewer, int direction) {
+    TextIndex* index = &viewer->text_index;
+    size_t offset = viewer->scroll_anchor.offset;
+    int paragraph = direction > 0 ? index_next_paragraph(index, offset) : index_prev_paragraph(index, offset);
+    if (paragraph >= 0) scroll_to_offset(viewer, index->paragraphs[paragraph]);
+}
+
+void jump_chapter(TextViewer* viewer, int direction) {
+    TextIndex* index = &viewer->text_index;
+    size_t offset = viewer->scroll_anchor.offset;
+    int chapter = direction > 0 ? index_next_chapter(index, offset) : index_prev_chapter(index, offset);
+    if (chapter >= 0) scroll_to_offset(viewer, index->chapters[chapter].offset);
+}
+
+// List the chapters, starting at the one that is read
+void open_table_of_contents(TextViewer* viewer) {
+    if (viewer->text_index.chapter_count == 0) return;
+    viewer->toc_open = 1;
+    viewer->toc_selected = MAX(0, index_chapter_at(&viewer->text_index, viewer->scroll_anchor.offset));
+}
+
+void handle_table_of_contents_key(TextViewer* viewer, SDLKey key) {
+    int count = viewer->text_index.chapter_count;
+    int rows = MAX(1, viewer->window_height / (int)(viewer->font_size * LINE_SPACING));
+    switch (key) {
+        case SDLK_u:
+        case SDLK_UP:
+            viewer->toc_selected--;
+            break;
+        case SDLK_d:
+        case SDLK_DOWN:
+            viewer->toc_selected++;
+            break;
+        case SDLK_m:
+        case SDLK_PAGEUP:
+            viewer->toc_selected -= rows;
+            break;
+        case SDLK_n:
+        case SDLK_PAGEDOWN:
+            viewer->toc_selected += rows;
+            break;
+        case SDLK_k:
+        case SDLK_HOME:
+            viewer->toc_selected = 0;
+            break;
+        case SDLK_s:
+        case SDLK_END:
+            viewer->toc_selected = count - 1;
+            break;
+        case SDLK_a:
+        case SDLK_RETURN:
+            viewer->toc_open = 0;
+            scroll_to_offset(viewer, viewer->text_index.chapters[viewer->toc_selected].offset);
+            break;
+        case SDLK_b:
+        case SDLK_t:
+        case SDLK_TAB:
+        case SDLK_q:
+        case SDLK_ESCAPE:
+            viewer->toc_open = 0;
+            break;
+        default:
+            break;
+    }
+    viewer->toc_selected = MAX(0, MIN(viewer->toc_selected, count - 1));
+}
+
+// One chapter title per line, the selected one inverted and kept in the middle
+void draw_table_of_contents(TextViewer* viewer, SDL_Surface* screen, SDL_Color fg, SDL_Color bg) {
+    TextIndex* index = &viewer->text_index;
+    int line_height = (int)(viewer->font_size * LINE_SPACING);
+    int rows = MAX(1, viewer->window_height / line_height);
+    int first = MAX(0, MIN(viewer->toc_selected - rows / 2, index->chapter_count - rows));
+    for (int row = 0; row < rows && first + row < index->chapter_count; row++) {
+        int chapter = first + row;
+        SDL_Color color = fg;
+        if (chapter == viewer->toc_selected) {
+            SDL_Rect bar = {0, row * line_height, viewer->window_width, line_height};
+            SDL_FillRect(screen, &bar, SDL_MapRGB(screen->format, fg.r, fg.g, fg.b));
+            color = bg;
+        }
+        SDL_Surface* text_surface = TTF_RenderUTF8_Blended(viewer->font, index->chapters[chapter].title, color);
+        if (text_surface) {
+            SDL_Rect dest = {MARGINS, row * line_height, 0, 0};
+            SDL_BlitSurface(text_surface, NULL, screen, &dest);
+            SDL_FreeSurface(text_surface);
+        }
+    }
 }
 
 int main(int argc, char* argv[]) {
@@ -1113,7 +1599,10 @@ int main(int argc, char* argv[]) {
         .text_color = {0, 0, 0, 0},      // Black
         .encoding = "UTF-8",
         .ignore_linebreaks = 0,
-        .inverted_colors = 0
+        .inverted_colors = 0,
+        .sparse_layout = 0,
+        .columns = 1,
+        .heading_pattern = ""
     };
     SDL_Color* current_color = NULL;
     char* config_file = NULL;
@@ -1122,6 +1611,7 @@ int main(int argc, char* argv[]) {
     int width = DEFAULT_WIDTH;
     int height = DEFAULT_HEIGHT;
     int fullscreen = 0;
+    int benchmark = 0;
 
     // First pass: identify files
     for (int i = 1; i < argc; i++) {
@@ -1137,6 +1627,9 @@ int main(int argc, char* argv[]) {
         else if (strcmp(argv[i], "-fullscreen") == 0) {
             fullscreen = 1;
         }
+        else if (strcmp(argv[i], "-benchmark") == 0) {
+            benchmark = 1;
+        }
         else if (!is_ttf_file(argv[i]) && !text_file) {
             text_file = resolve_path(argv[i]);
         }
@@ -1167,6 +1660,12 @@ int main(int argc, char* argv[]) {
         else if (strcmp(argv[i], "-inverted_colors") == 0) {
             config.inverted_colors = 1;
         }        
+        else if (strcmp(argv[i], "-sparse_layout") == 0) {
+            config.sparse_layout = 1;
+        }
+        else if (strncmp(argv[i], "-columns=", 9) == 0) {
+            config.columns = atoi(argv[i] + 9);
+        }
         else if (!text_file) {
             text_file = resolve_path(argv[i]);
         }
@@ -1239,11 +1738,35 @@ int main(int argc, char* argv[]) {
     
     printf("Using Settings PAth: %s\n", settings_path);
 
+    // Time the layout without opening a window
+    if (benchmark) {
+        TextViewer* viewer = create_viewer(settings_path, config.font_path, config.font_size,
+            width, height, config.text_color, config.bg_color, config.ignore_linebreaks, config.inverted_colors);
+        if (viewer) {
+            viewer->sparse_layout = config.sparse_layout;
+            viewer->columns = MAX(1, config.columns);
+            snprintf(viewer->heading_pattern, sizeof(viewer->heading_pattern), "%s", config.heading_pattern);
+        }
+        int loaded = viewer && load_text_file(viewer, text_file, config.encoding);
+        if (loaded) {
+            run_layout_benchmark(viewer);
+        } else {
+            printf("Failed to load text file: %s\n", text_file);
+        }
+        if (viewer) destroy_viewer(viewer);
+        TTF_CloseFont(InteralFont);
+        TTF_Quit();
+        SDL_Quit();
+        return loaded ? 0 : 1;
+    }
+
     
     // Set video mode
     Uint32 flags = SDL_SWSURFACE;
     if (fullscreen)
         flags |= SDL_FULLSCREEN;
+    else
+        flags |= SDL_RESIZABLE;
 
     SDL_Surface* screen = SDL_SetVideoMode(width, height, 32, flags);
     if (!screen) {
@@ -1272,6 +1795,9 @@ int main(int argc, char* argv[]) {
         SDL_Quit();       
         return 1;
     }
+    viewer->sparse_layout = config.sparse_layout;
+    viewer->columns = MAX(1, config.columns);
+    snprintf(viewer->heading_pattern, sizeof(viewer->heading_pattern), "%s", config.heading_pattern);
     
     SDL_FillRect(screen, NULL, SDL_MapRGB(screen->format, config.bg_color.r, config.bg_color.b, config.bg_color.b));
     display_message("Loading TXT File", 1000, width >> 1, height >> 1, 5, config.bg_color, config.text_color);
@@ -1301,15 +1827,10 @@ int main(int argc, char* argv[]) {
     SDL_EnableUNICODE(1);
     SDL_EnableKeyRepeat(SDL_DEFAULT_REPEAT_DELAY, SDL_DEFAULT_REPEAT_INTERVAL);
 
-    SDL_FillRect(screen, NULL, SDL_MapRGB(screen->format, config.bg_color.r, config.bg_color.b, config.bg_color.b));
-    display_message("Calculating Layouts", 1000, width >> 1, height >> 1, 5, config.bg_color, config.text_color);
-    draw_display_message(screen);
-    SDL_Flip(screen);
-
-    // Calculate the layouts
-    calculate_text_layout(viewer, &viewer->normal_layout, viewer->text);
-    calculate_text_layout(viewer, &viewer->adjusted_layout, viewer->adjustested_text);
-    
+    // Lay out in the background, meanwhile only the lines on screen
+    // are laid out. The restored position may need the last page instead
+    reset_layouts(viewer);
+    enforce_scroll_boundaries(viewer);
     stop_display_message();
 
     // Render once
@@ -1320,13 +1841,41 @@ int main(int argc, char* argv[]) {
     int running = 1;
     char msg[1024];
     SDL_Event event;
+    Uint32 next_progress_update = 0;
+    int resized_width = 0;
+    Uint32 relayout_time = 0;
+    // SELECT held down turns LEFT / RIGHT into paragraph jumps on handhelds,
+    // alone it jumps to the start once it is let go
+    int select_held = 0;
+    int select_used = 0;
     while (running) {
         while (SDL_PollEvent(&event)) {
             switch (event.type) {                
                 case SDL_QUIT:
                     running = 0;
                     break;
+                case SDL_VIDEORESIZE:
+                    screen = SDL_SetVideoMode(event.resize.w, event.resize.h, 32, flags);
+                    if (!screen) {
+                        printf("Failed to set video mode: %s\n", SDL_GetError());
+                        running = 0;
+                        break;
+                    }
+                    // The height only changes how many lines are drawn, the
+                    // width is laid out for once the window stops changing
+                    viewer->window_height = event.resize.h;
+                    resized_width = event.resize.w;
+                    relayout_time = SDL_GetTicks() + RESIZE_DELAY_MS;
+                    enforce_scroll_boundaries(viewer);
+                    render_text(viewer, screen);
+                    break;
                 case SDL_KEYDOWN:
+                    // The chapter list takes the keys while it is shown
+                    if (viewer->toc_open) {
+                        handle_table_of_contents_key(viewer, event.key.keysym.sym);
+                        render_text(viewer, screen);
+                        break;
+                    }
                     switch (event.key.keysym.sym) {
                         case SDLK_a:
                             sprintf(msg, "Reloading (font size %d)", viewer->font_size);
@@ -1350,58 +1899,110 @@ int main(int argc, char* argv[]) {
                             viewer->inverted_colors = !viewer->inverted_colors;
                             render_text(viewer, screen);
                             break;
-                        case SDLK_y:  // Toggle ignore linebreaks mode
-                            viewer->ignore_linebreaks = !viewer->ignore_linebreaks;
+                        case SDLK_y:  // Cycle normal, ignore linebreaks and no wrap modes
+                            if (viewer->no_wrap) {
+                                viewer->no_wrap = 0;
+                            } else if (viewer->ignore_linebreaks) {
+                                viewer->ignore_linebreaks = 0;
+                                viewer->no_wrap = 1;
+                                viewer->scroll_x = 0;
+                            } else {
+                                viewer->ignore_linebreaks = 1;
+                            }
+                            enforce_scroll_boundaries(viewer);
                             render_text(viewer, screen);
                             break;                         
                         case SDLK_k:
+                            if (!select_held) select_used = 0;
+                            select_held = 1;
+                            break;
                         case SDLK_HOME:
                             // Jump to the beginning of the text
-                            if(viewer->ignore_linebreaks)
-                                viewer->scroll_position_adjusted = 0;
-                            else
-                                viewer->scroll_position = 0;
+                            scroll_to_start(viewer);
                             render_text(viewer, screen);
                             break;
                         case SDLK_s:
                         case SDLK_END:
                             // Jump to end of text
-                            if(viewer->ignore_linebreaks)
-                                viewer->scroll_position_adjusted = MAX(0, viewer->adjusted_layout.calculated_total_height - viewer->window_height);
-                            else
-                                viewer->scroll_position = MAX(0, viewer->normal_layout.calculated_total_height - viewer->window_height);
+                            scroll_to_end(viewer);
                             render_text(viewer, screen);
                             break;
                         case SDLK_u:
                         case SDLK_UP:
-                            if(viewer->ignore_linebreaks)
-                                viewer->scroll_position_adjusted = MAX(0, viewer->scroll_position_adjusted - viewer->font_size);
-                            else
-                                viewer->scroll_position = MAX(0, viewer->scroll_position - viewer->font_size);
+                            scroll_viewer(viewer, -viewer->font_size);
                             render_text(viewer, screen);
                             break;
                         case SDLK_d:
                         case SDLK_DOWN:
-                            if(viewer->ignore_linebreaks)
-                                viewer->scroll_position_adjusted = MIN(viewer->adjusted_layout.calculated_total_height - viewer->window_height, viewer->scroll_position_adjusted + viewer->font_size);
-                            else
-                                viewer->scroll_position = MIN(viewer->normal_layout.calculated_total_height - viewer->window_height, viewer->scroll_position + viewer->font_size);
+                            scroll_viewer(viewer, viewer->font_size);
+                            render_text(viewer, screen);
+                            break;
+                        case SDLK_l:
+                        case SDLK_LEFT:
+                            // To the paragraph before with SELECT held, sideways when the
+                            // lines are not wrapped, else to the chapter before
+                            if (select_held) {
+                                select_used = 1;
+                                jump_paragraph(viewer, -1);
+                            } else if (viewer->no_wrap) {
+                                scroll_viewer_x(viewer, -(viewer->window_width >> 2));
+                            } else {
+                                jump_chapter(viewer, -1);
+                                show_page_number(viewer);
+                            }
+                            render_text(viewer, screen);
+                            break;
+                        case SDLK_r:
+                        case SDLK_RIGHT:
+                            if (select_held) {
+                                select_used = 1;
+                                jump_paragraph(viewer, 1);
+                            } else if (viewer->no_wrap) {
+                                scroll_viewer_x(viewer, viewer->window_width >> 2);
+                            } else {
+                                jump_chapter(viewer, 1);
+                                show_page_number(viewer);
+                            }
+                            render_text(viewer, screen);
+                            break;
+                        case SDLK_LEFTBRACKET:
+                            jump_paragraph(viewer, -1);
+                            render_text(viewer, screen);
+                            break;
+                        case SDLK_RIGHTBRACKET:
+                            jump_paragraph(viewer, 1);
+                            render_text(viewer, screen);
+                            break;
+                        case SDLK_t:
+                        case SDLK_TAB:
+                            open_table_of_contents(viewer);
                             render_text(viewer, screen);
                             break;
                         case SDLK_m:
                         case SDLK_PAGEUP:
-                            if(viewer->ignore_linebreaks)
-                                viewer->scroll_position_adjusted = MAX(0, viewer->scroll_position_adjusted - viewer->window_height);
-                            else
-                                viewer->scroll_position = MAX(0, viewer->scroll_position - viewer->window_height);
+                            scroll_page(viewer, -1);
+                            show_page_number(viewer);
                             render_text(viewer, screen);
                             break;
                         case SDLK_n:
                         case SDLK_PAGEDOWN:
-                            if(viewer->ignore_linebreaks)
-                                viewer->scroll_position_adjusted = MIN(viewer->adjusted_layout.calculated_total_height - viewer->window_height, viewer->scroll_position_adjusted + viewer->window_height);
-                            else
-                                viewer->scroll_position = MIN(viewer->normal_layout.calculated_total_height - viewer->window_height, viewer->scroll_position + viewer->window_height);
+                            scroll_page(viewer, 1);
+                            show_page_number(viewer);
+                            render_text(viewer, screen);
+                            break;
+                        case SDLK_0:
+                        case SDLK_1:
+                        case SDLK_2:
+                        case SDLK_3:
+                        case SDLK_4:
+                        case SDLK_5:
+                        case SDLK_6:
+                        case SDLK_7:
+                        case SDLK_8:
+                        case SDLK_9:
+                            // Jump to 0% to 90% of the text
+                            scroll_to_percent(viewer, (event.key.keysym.sym - SDLK_0) * 10);
+                            show_page_number(viewer);
                             render_text(viewer, screen);
                             break;
                         case SDLK_q:
@@ -1412,10 +2013,38 @@ int main(int argc, char* argv[]) {
                             break;
                     }
                     break;
+                case SDL_KEYUP:
+                    if (event.key.keysym.sym != SDLK_k || !select_held) break;
+                    select_held = 0;
+                    if (!select_used && !viewer->toc_open) {
+                        // Jump to the beginning of the text
+                        scroll_to_start(viewer);
+                        render_text(viewer, screen);
+                    }
+                    break;
             }
         }
+        // The screen is gone when the window could not be resized
+        if (!running) break;
+        if (resized_width && SDL_GetTicks() >= relayout_time) {
+            change_window_width(viewer, resized_width);
+            resized_width = 0;
+            render_text(viewer, screen);
+        }
+        // Take the page number down again
+        if (viewer->page_shown_until && SDL_GetTicks() >= viewer->page_shown_until) {
+            viewer->page_shown_until = 0;
+            render_text(viewer, screen);
+        }
+        // Redraw a few times a second while the layout progress is shown
+        if (viewer->showing_progress && SDL_GetTicks() >= next_progress_update) {
+            next_progress_update = SDL_GetTicks() + 250;
+            render_text(viewer, screen);
+        }
+        prefetch_layouts(viewer);
         SDL_Flip(screen);
-        SDL_Delay(16);
+        // A slice of layout takes the place of the wait
+        if (!step_layouts(viewer)) SDL_Delay(16);
     }
 
     // Save scroll position before exiting
@@ -0,0 +1,160 @@
+/* paragraph_memo.c */
+#include <stdlib.h>
+#include <string.h>
+#include "paragraph_memo.h"
+
+static void destroy_locks(ParagraphMemo* memo) {
+    for (int i = 0; i < MEMO_LOCKS; i++) {
+        if (memo->locks[i]) SDL_DestroyMutex(memo->locks[i]);
+    }
+}
+
+ParagraphMemo* paragraph_memo_create(void) {
+    ParagraphMemo* memo = calloc(1, sizeof(ParagraphMemo));
+    if (!memo) return NULL;
+    for (int i = 0; i < MEMO_LOCKS; i++) {
+        memo->locks[i] = SDL_CreateMutex();
+        if (!memo->locks[i]) {
+            destroy_locks(memo);
+            free(memo);
+            return NULL;
+        }
+    }
+    return memo;
+}
+
+// Callers hold every lock, or are the only ones left using the memo
+static void clear_entries(ParagraphMemo* memo) {
+    for (int i = 0; i < MEMO_BUCKETS; i++) {
+        MemoEntry* entry = memo->buckets[i];
+        while (entry) {
+            MemoEntry* next = entry->next;
+            free(entry);
+            entry = next;
+        }
+        memo->buckets[i] = NULL;
+    }
+    __atomic_store_n(&memo->memory_used, 0, __ATOMIC_RELAXED);
+}
+
+void paragraph_memo_destroy(ParagraphMemo* memo) {
+    if (!memo) return;
+    clear_entries(memo);
+    destroy_locks(memo);
+    free(memo);
+}
+
+Uint64 paragraph_hash(const char* text, size_t length) {
+    // FNV-1a
+    Uint64 hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+Uint64 paragraph_check(const char* text, size_t length) {
+    // Add then multiply, with a rotation to mix the high bits back
+    Uint64 check = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < length; i++) {
+        check = (check + (unsigned char)text[i]) * 0xC2B2AE3D27D4EB4Full;
+        check = (check << 31) | (check >> 33);
+    }
+    return check;
+}
+
+static int same_key(const ParagraphKey* a, const ParagraphKey* b) {
+    return a->hash == b->hash && a->check == b->check && a->length == b->length &&
+        a->font_id == b->font_id && a->max_width == b->max_width &&
+        a->font_size == b->font_size && a->ignore_linebreaks == b->ignore_linebreaks;
+}
+
+static int bucket_index(const ParagraphKey* key) {
+    return (int)((key->hash ^ (key->hash >> 32) ^ (Uint32)key->max_width) & (MEMO_BUCKETS - 1));
+}
+
+static SDL_mutex* lock_of(ParagraphMemo* memo, int bucket) {
+    return memo->locks[bucket & (MEMO_LOCKS - 1)];
+}
+
+int paragraph_memo_find(ParagraphMemo* memo, const ParagraphKey* key, Uint32* lines) {
+    int count = -1;
+    int bucket = bucket_index(key);
+    SDL_mutexP(lock_of(memo, bucket));
+    for (MemoEntry* entry = memo->buckets[bucket]; entry; entry = entry->next) {
+        if (same_key(&entry->key, key)) {
+            // Copied, the entry may be dropped once the lock is released
+            count = entry->line_count;
+            memcpy(lines, entry->lines, 2 * count * sizeof(Uint32));
+            break;
+        }
+    }
+    SDL_mutexV(lock_of(memo, bucket));
+    return count;
+}
+
+// Drop every entry, taking the locks in order so two threads over the
+// limit at once cannot deadlock
+static void drop_all_entries(ParagraphMemo* memo) {
+    for (int i = 0; i < MEMO_LOCKS; i++) SDL_mutexP(memo->locks[i]);
+    if (__atomic_load_n(&memo->memory_used, __ATOMIC_RELAXED) > MEMO_MEMORY_LIMIT) clear_entries(memo);
+    for (int i = MEMO_LOCKS - 1; i >= 0; i--) SDL_mutexV(memo->locks[i]);
+}
+
+static void add_entry(ParagraphMemo* memo, const ParagraphKey* key, const Uint32* lines, int count, int width) {
+    size_t size = sizeof(MemoEntry) + 2 * count * sizeof(Uint32);
+    MemoEntry* entry = malloc(size);
+    if (!entry) return;
+    entry->key = *key;
+    entry->line_count = count;
+    entry->width = width;
+    memcpy(entry->lines, lines, 2 * count * sizeof(Uint32));
+
+    int index = bucket_index(key);
+    SDL_mutexP(lock_of(memo, index));
+    MemoEntry** bucket = &memo->buckets[index];
+    for (MemoEntry* other = *bucket; other; other = other->next) {
+        if (same_key(&other->key, key)) {
+            // Another thread laid out the same paragraph meanwhile
+            SDL_mutexV(lock_of(memo, index));
+            free(entry);
+            return;
+        }
+    }
+    entry->next = *bucket;
+    *bucket = entry;
+    size_t used = __atomic_add_fetch(&memo->memory_used, size, __ATOMIC_RELAXED);
+    SDL_mutexV(lock_of(memo, index));
+
+    // The new entry goes too, it is cheap to lay out again
+    if (used > MEMO_MEMORY_LIMIT) drop_all_entries(memo);
+}
+
+void paragraph_memo_add(ParagraphMemo* memo, const ParagraphKey* key, const Uint32* lines, int count) {
+    if (count > MEMO_MAX_LINES) return;
+    add_entry(memo, key, lines, count, 0);
+}
+
+void paragraph_memo_add_line(ParagraphMemo* memo, const ParagraphKey* key, int width) {
+    ParagraphKey any = *key;
+    any.max_width = MEMO_ANY_WIDTH;
+    Uint32 line[2] = { 0, key->length << 1 };
+    add_entry(memo, &any, line, 1, width);
+}
+
+int paragraph_memo_fits(ParagraphMemo* memo, const ParagraphKey* key) {
+    ParagraphKey any = *key;
+    any.max_width = MEMO_ANY_WIDTH;
+    int fits = 0;
+    int bucket = bucket_index(&any);
+    SDL_mutexP(lock_of(memo, bucket));
+    for (MemoEntry* entry = memo->buckets[bucket]; entry; entry = entry->next) {
+        if (same_key(&entry->key, &any)) {
+            fits = entry->width <= key->max_width;
+            break;
+        }
+    }
+    SDL_mutexV(lock_of(memo, bucket));
+    return fits;
+}
@@ -0,0 +1,68 @@
+/* paragraph_memo.h */
+#ifndef PARAGRAPH_MEMO_H
+#define PARAGRAPH_MEMO_H
+
+#include <stddef.h>
+#include <SDL/SDL.h>
+#include <SDL/SDL_mutex.h>
+
+#define MEMO_BUCKETS 4096
+#define MEMO_LOCKS 64                // Each guards every MEMO_LOCKS-th bucket
+#define MEMO_MAX_LINES 256
+#define MEMO_MEMORY_LIMIT (4 * 1024 * 1024)
+#define MEMO_ANY_WIDTH 0             // max_width of the entries of single line paragraphs
+
+/* What the lines of a paragraph depend on */
+typedef struct {
+    Uint64 hash;                 // paragraph_hash of its bytes
+    Uint64 check;                // paragraph_check of its bytes, so one colliding hash is no match
+    Uint32 length;
+    Uint64 font_id;              // paragraph_hash of the font path, see LayoutSource
+    int max_width;
+    int font_size;
+    int ignore_linebreaks;
+} ParagraphKey;
+
+typedef struct MemoEntry {
+    struct MemoEntry* next;
+    ParagraphKey key;
+    int line_count;
+    int width;                   // Of the line when max_width is MEMO_ANY_WIDTH
+    Uint32 lines[];              // Per line: start in the paragraph, length << 1 | is_wrapped
+} MemoEntry;
+
+/* Line breaks of paragraphs laid out before, shared by all layouts of a
+ * text and their threads. Identical paragraphs share one entry. When the
+ * entries take more than MEMO_MEMORY_LIMIT bytes they are all dropped.
+ * The buckets are locked in stripes, so the layout threads rarely wait
+ * for each other.
+ */
+typedef struct {
+    SDL_mutex* locks[MEMO_LOCKS];
+    MemoEntry* buckets[MEMO_BUCKETS];
+    size_t memory_used;          // Updated atomically, outside the locks
+} ParagraphMemo;
+
+ParagraphMemo* paragraph_memo_create(void);
+void paragraph_memo_destroy(ParagraphMemo* memo);
+
+Uint64 paragraph_hash(const char* text, size_t length);
+/* A second hash, computed unlike paragraph_hash */
+Uint64 paragraph_check(const char* text, size_t length);
+
+/* Copy the lines of a paragraph into lines (2 values per line, at most
+ * MEMO_MAX_LINES lines). Returns the line count, -1 when it is unknown.
+ */
+int paragraph_memo_find(ParagraphMemo* memo, const ParagraphKey* key, Uint32* lines);
+
+/* Remember the lines of a paragraph, count is at most MEMO_MAX_LINES */
+void paragraph_memo_add(ParagraphMemo* memo, const ParagraphKey* key, const Uint32* lines, int count);
+
+/* A paragraph that fits on one line width pixels wide is remembered for
+ * every max_width, so a relayout at another width does not measure it
+ * again. paragraph_memo_fits returns 1 when it fits in key's max_width.
+ */
+void paragraph_memo_add_line(ParagraphMemo* memo, const ParagraphKey* key, int width);
+int paragraph_memo_fits(ParagraphMemo* memo, const ParagraphKey* key);
+
+#endif
@@ -0,0 +1,207 @@
+/* text_index.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <regex.h>
+#endif
+#include "text_index.h"
+
+void init_text_index(TextIndex* index) {
+    memset(index, 0, sizeof(TextIndex));
+}
+
+void free_text_index(TextIndex* index) {
+    free(index->paragraphs);
+    free(index->chapters);
+    init_text_index(index);
+}
+
+static int reserve_entries(void** entries, int* capacity, int count, size_t entry_size) {
+    if (count < *capacity) return 1;
+    int grown = *capacity ? *capacity * 2 : INDEX_CHUNK;
+    void* resized = realloc(*entries, grown * entry_size);
+    if (!resized) return 0;
+    *entries = resized;
+    *capacity = grown;
+    return 1;
+}
+
+static int add_paragraph(TextIndex* index, size_t offset) {
+    if (!reserve_entries((void**)&index->paragraphs, &index->paragraph_capacity,
+                         index->paragraph_count, sizeof(size_t))) return 0;
+    index->paragraphs[index->paragraph_count++] = offset;
+    return 1;
+}
+
+static int add_chapter(TextIndex* index, size_t offset, const char* title, size_t length) {
+    if (!reserve_entries((void**)&index->chapters, &index->chapter_capacity,
+                         index->chapter_count, sizeof(TextChapter))) return 0;
+    TextChapter* chapter = &index->chapters[index->chapter_count++];
+    chapter->offset = offset;
+    // Cut at the start of a character
+    if (length > CHAPTER_TITLE_MAX) {
+        length = CHAPTER_TITLE_MAX;
+        while (length > 0 && ((unsigned char)title[length] & 0xC0) == 0x80) length--;
+    }
+    memcpy(chapter->title, title, length);
+    chapter->title[length] = '\0';
+    return 1;
+}
+
+static int is_roman_numeral(const char* text, size_t length) {
+    if (length == 0 || length > 8) return 0;
+    for (size_t i = 0; i < length; i++) {
+        if (!strchr("IVXLCDM", text[i])) return 0;
+    }
+    return 1;
+}
+
+static int is_upper_line(const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] >= 'a' && text[i] <= 'z') return 0;
+    }
+    return 1;
+}
+
+// Length of the word at text, up to a space or punctuation
+static size_t word_length(const char* text, size_t length) {
+    size_t i = 0;
+    while (i < length && text[i] != ' ' && text[i] != '\t' && text[i] != '.' && text[i] != ':') i++;
+    return i;
+}
+
+// A trimmed line that starts a paragraph and reads like a heading
+static int is_heading(const char* text, size_t length) {
+    static const char* numbered[] = { "CHAPTER", "BOOK", "PART", "VOLUME", "CANTO", NULL };
+    static const char* named[] = { "PROLOGUE", "EPILOGUE", "PREFACE", "INTRODUCTION", NULL };
+    if (text[0] < 'A' || text[0] > 'Z') return 0;
+
+    size_t word = word_length(text, length);
+    for (int i = 0; numbered[i]; i++) {
+        if (word != strlen(numbered[i]) || strncasecmp(text, numbered[i], word) != 0) continue;
+        // Followed by a number, a roman numeral or an upper case title
+        size_t next = word;
+        while (next < length && (text[next] == ' ' || text[next] == '\t')) next++;
+        if (next == length) return 0;
+        if (text[next] >= '0' && text[next] <= '9') return 1;
+        if (is_roman_numeral(text + next, word_length(text + next, length - next))) return 1;
+        return is_upper_line(text, length);
+    }
+    for (int i = 0; named[i]; i++) {
+        if (word == strlen(named[i]) && strncasecmp(text, named[i], word) == 0) return 1;
+    }
+
+    // A roman numeral alone, or with a full stop before a title
+    if (!is_roman_numeral(text, word)) return 0;
+    return word == length || text[word] == '.';
+}
+
+// Offset of the first c at or after start, length when there is none
+static size_t find_byte(const char* text, size_t start, size_t length, char c) {
+    const char* found = memchr(text + start, c, length - start);
+    return found ? (size_t)(found - text) : length;
+}
+
+int build_text_index(TextIndex* index, const char* text, size_t length, const char* heading_pattern) {
+    index->paragraph_count = 0;
+    index->chapter_count = 0;
+
+    int use_pattern = heading_pattern && heading_pattern[0];
+#ifndef _WIN32
+    regex_t pattern;
+    if (use_pattern && regcomp(&pattern, heading_pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+        printf("Ignoring invalid heading pattern: %s\n", heading_pattern);
+        use_pattern = 0;
+    }
+#endif
+
+    // memchr finds the line ends, the bytes in between are only looked at
+    // up to the first and from the last visible character. Lines end at a
+    // CR, an LF or a CR LF pair as in the layout, the next of each is kept
+    // until a line passes it
+    int ok = 1;
+    int after_blank = 1;
+    size_t start = 0;
+    size_t next_lf = find_byte(text, 0, length, '\n');
+    size_t next_cr = find_byte(text, 0, length, '\r');
+    while (ok && start < length) {
+        if (next_lf < start) next_lf = find_byte(text, start, length, '\n');
+        if (next_cr < start) next_cr = find_byte(text, start, length, '\r');
+        size_t end = next_lf < next_cr ? next_lf : next_cr;
+        size_t first = start;
+        while (first < end && (text[first] == ' ' || text[first] == '\t')) first++;
+        size_t last = end;
+        while (last > first && (text[last - 1] == ' ' || text[last - 1] == '\t')) last--;
+
+        if (first == last) {
+            after_blank = 1;
+        } else {
+            int starts_paragraph = after_blank || first > start;
+            if (starts_paragraph) ok = add_paragraph(index, start);
+
+            size_t visible = last - first;
+            int heading = 0;
+            if (visible <= HEADING_LINE_MAX) {
+                heading = starts_paragraph && is_heading(text + first, visible);
+                if (!heading && use_pattern) {
+                    char line[HEADING_LINE_MAX + 1];
+                    memcpy(line, text + first, visible);
+                    line[visible] = '\0';
+#ifndef _WIN32
+                    heading = regexec(&pattern, line, 0, NULL, 0) == 0;
+#else
+                    heading = strncmp(line, heading_pattern, strlen(heading_pattern)) == 0;
+#endif
+                }
+            }
+            if (ok && heading) ok = add_chapter(index, start, text + first, visible);
+            after_blank = 0;
+        }
+        start = end + (end + 1 < length && text[end] == '\r' && text[end + 1] == '\n' ? 2 : 1);
+    }
+
+#ifndef _WIN32
+    if (use_pattern) regfree(&pattern);
+#endif
+    return ok;
+}
+
+// Entries starting before offset, or at it too when inclusive. The offset
+// is the first member of each entry, stride bytes apart
+static int count_starts(const void* entries, size_t stride, int count, size_t offset, int inclusive) {
+    int left = 0;
+    int right = count;
+    while (left < right) {
+        int middle = left + (right - left) / 2;
+        size_t start = *(const size_t*)((const char*)entries + middle * stride);
+        if (start < offset || (inclusive && start == offset)) {
+            left = middle + 1;
+        } else {
+            right = middle;
+        }
+    }
+    return left;
+}
+
+int index_next_paragraph(const TextIndex* index, size_t offset) {
+    int next = count_starts(index->paragraphs, sizeof(size_t), index->paragraph_count, offset, 1);
+    return next < index->paragraph_count ? next : -1;
+}
+
+int index_prev_paragraph(const TextIndex* index, size_t offset) {
+    return count_starts(index->paragraphs, sizeof(size_t), index->paragraph_count, offset, 0) - 1;
+}
+
+int index_next_chapter(const TextIndex* index, size_t offset) {
+    int next = count_starts(index->chapters, sizeof(TextChapter), index->chapter_count, offset, 1);
+    return next < index->chapter_count ? next : -1;
+}
+
+int index_prev_chapter(const TextIndex* index, size_t offset) {
+    return count_starts(index->chapters, sizeof(TextChapter), index->chapter_count, offset, 0) - 1;
+}
+
+int index_chapter_at(const TextIndex* index, size_t offset) {
+    return count_starts(index->chapters, sizeof(TextChapter), index->chapter_count, offset, 1) - 1;
+}
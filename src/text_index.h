@@ -0,0 +1,53 @@
+/* text_index.h */
+#ifndef TEXT_INDEX_H
+#define TEXT_INDEX_H
+
+#include <stddef.h>
+
+#define CHAPTER_TITLE_MAX 64         // Bytes of a heading kept as its title
+#define HEADING_LINE_MAX 80          // Longer lines are never taken for a heading
+#define INDEX_CHUNK 1024             // Entries the tables start with, they double from there
+
+typedef struct {
+    size_t offset;                   // Start of the heading line
+    char title[CHAPTER_TITLE_MAX + 1];
+} TextChapter;
+
+/* Where the paragraphs and chapters of a text start, in text order. A
+ * paragraph starts at a line after a blank line or at an indented line,
+ * a chapter at a paragraph that is a short heading line: CHAPTER, BOOK,
+ * PART and the like followed by a number or a title, or a roman numeral
+ * on its own.
+ */
+typedef struct {
+    size_t* paragraphs;
+    int paragraph_count;
+    int paragraph_capacity;
+    TextChapter* chapters;
+    int chapter_count;
+    int chapter_capacity;
+} TextIndex;
+
+void init_text_index(TextIndex* index);
+void free_text_index(TextIndex* index);
+
+/* Index the text in one pass over its lines, which end at a CR, an LF
+ * or a CR LF pair like in the layout. Lines matching the POSIX
+ * extended regular expression heading_pattern are chapters as well, it
+ * may be NULL or empty and is a plain prefix on Windows. Returns 0 when
+ * out of memory.
+ */
+int build_text_index(TextIndex* index, const char* text, size_t length, const char* heading_pattern);
+
+/* Binary searches, -1 when there is no such paragraph or chapter. The
+ * previous one starts before offset, the next one after it.
+ */
+int index_next_paragraph(const TextIndex* index, size_t offset);
+int index_prev_paragraph(const TextIndex* index, size_t offset);
+int index_next_chapter(const TextIndex* index, size_t offset);
+int index_prev_chapter(const TextIndex* index, size_t offset);
+
+/* Chapter that offset is in, -1 before the first one */
+int index_chapter_at(const TextIndex* index, size_t offset);
+
+#endif
@@ -0,0 +1,37 @@
+/* unicode_tables.h */
+#ifndef UNICODE_TABLES_H
+#define UNICODE_TABLES_H
+
+#include <SDL/SDL.h>
+
+#define UNICODE_BLOCK_SIZE 256
+#define UNICODE_BLOCKS (0x110000 / UNICODE_BLOCK_SIZE)
+
+/* UAX #14 line break classes, as far as the layout tells them apart.
+ * Quotation marks are split into opening (QU_PI) and closing (QU_PF).
+ * The order matches tools/gen_unicode_tables.py.
+ */
+enum LineBreakClass {
+    LB_AL, LB_BA, LB_B2, LB_BK, LB_CJ, LB_CL, LB_CM, LB_CP, LB_CR, LB_EX, LB_GL, LB_H2, LB_H3, LB_HY,
+    LB_ID, LB_IN, LB_IS, LB_JL, LB_JT, LB_JV, LB_LF, LB_NS, LB_NU, LB_OP, LB_QU, LB_QU_PI, LB_QU_PF,
+    LB_RI, LB_SP, LB_SY, LB_WJ, LB_ZW, LB_ZWJ
+};
+
+/* UAX #29 grapheme cluster break property, Extended_Pictographic included.
+ * The order matches tools/gen_unicode_tables.py.
+ */
+enum GraphemeBreak {
+    GB_OTHER, GB_CR, GB_LF, GB_CONTROL, GB_EXTEND, GB_ZWJ, GB_REGIONAL_INDICATOR, GB_PREPEND,
+    GB_SPACING_MARK, GB_L, GB_V, GB_T, GB_LV, GB_LVT, GB_EXTENDED_PICTOGRAPHIC
+};
+
+/* Two-stage tables generated by tools/gen_unicode_tables.py: the class of
+ * c is classes[blocks[c / UNICODE_BLOCK_SIZE]][c % UNICODE_BLOCK_SIZE].
+ * Blocks with the same classes are stored once.
+ */
+extern const Uint16 line_break_blocks[UNICODE_BLOCKS];
+extern const Uint8 line_break_classes[][UNICODE_BLOCK_SIZE];
+extern const Uint16 grapheme_break_blocks[UNICODE_BLOCKS];
+extern const Uint8 grapheme_break_classes[][UNICODE_BLOCK_SIZE];
+
+#endif
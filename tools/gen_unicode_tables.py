@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""Generate src/unicode_tables.c, the line break (UAX #14) and grapheme
+cluster break (UAX #29) classes of every code point as two-stage tables.
+
+    gen_unicode_tables.py ucd_dir [version] > src/unicode_tables.c
+
+ucd_dir holds LineBreak.txt, GraphemeBreakProperty.txt, UnicodeData.txt and
+emoji-data.txt of one release from https://www.unicode.org/Public/<version>/ucd/
+(emoji-data.txt is in its emoji directory). The release is read from the
+file headers and must be version when that is given. Fails when a file is
+missing, the tables are never guessed.
+"""
+
+import os
+import sys
+
+MAX_CODEPOINT = 0x110000
+BLOCK = 256
+
+# Must match enum LineBreakClass in unicode_tables.h
+LINE_BREAK_CLASSES = [
+    "AL", "BA", "B2", "BK", "CJ", "CL", "CM", "CP", "CR", "EX", "GL", "H2", "H3", "HY",
+    "ID", "IN", "IS", "JL", "JT", "JV", "LF", "NS", "NU", "OP", "QU", "QU_PI", "QU_PF",
+    "RI", "SP", "SY", "WJ", "ZW", "ZWJ",
+]
+
+# Must match enum GraphemeBreak in unicode_tables.h
+GRAPHEME_CLASSES = [
+    "Other", "CR", "LF", "Control", "Extend", "ZWJ", "Regional_Indicator", "Prepend",
+    "SpacingMark", "L", "V", "T", "LV", "LVT", "Extended_Pictographic",
+]
+
+# UAX #14 classes the layout does not tell apart from AL
+LINE_BREAK_ALIASES = {
+    "AI": "AL", "AK": "AL", "AP": "AL", "AS": "AL", "BB": "AL", "CB": "AL", "EB": "ID",
+    "EM": "ID", "HL": "AL", "NL": "BK", "PO": "AL", "PR": "AL", "SA": "AL", "SG": "AL",
+    "VF": "AL", "VI": "AL", "XX": "AL",
+}
+
+
+def parse_ranges(path, wanted=None):
+    """Yield (first, last, value) of a UCD property file"""
+    with open(path, encoding="utf-8") as ucd:
+        for line in ucd:
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            codepoints, value = [field.strip() for field in line.split(";")[:2]]
+            if wanted and value not in wanted:
+                continue
+            first, _, last = codepoints.partition("..")
+            yield int(first, 16), int(last or first, 16), value
+
+
+def split_quotes(classes, ucd_dir):
+    """Opening and closing quotation marks behave like OP and CL (UAX #14 LB15a/b)"""
+    with open(os.path.join(ucd_dir, "UnicodeData.txt"), encoding="utf-8") as ucd:
+        for line in ucd:
+            fields = line.split(";")
+            c = int(fields[0], 16)
+            if classes[c] == "QU" and fields[2] in ("Pi", "Pf"):
+                classes[c] = "QU_PI" if fields[2] == "Pi" else "QU_PF"
+
+
+def line_breaks_from_ucd(ucd_dir):
+    classes = ["AL"] * MAX_CODEPOINT
+    for first, last, value in parse_ranges(os.path.join(ucd_dir, "LineBreak.txt")):
+        value = LINE_BREAK_ALIASES.get(value, value)
+        for c in range(first, last + 1):
+            classes[c] = value
+    split_quotes(classes, ucd_dir)
+    return classes
+
+
+def graphemes_from_ucd(ucd_dir):
+    classes = ["Other"] * MAX_CODEPOINT
+    for first, last, value in parse_ranges(os.path.join(ucd_dir, "GraphemeBreakProperty.txt")):
+        for c in range(first, last + 1):
+            classes[c] = value
+    emoji = os.path.join(ucd_dir, "emoji-data.txt")
+    for first, last, _ in parse_ranges(emoji, {"Extended_Pictographic"}):
+        for c in range(first, last + 1):
+            classes[c] = "Extended_Pictographic"
+    return classes
+
+
+def emit_table(name, classes, names):
+    """Split the classes into blocks of BLOCK code points and share equal blocks"""
+    index = {value: i for i, value in enumerate(names)}
+    blocks = []
+    block_of = {}
+    stage1 = []
+    for start in range(0, MAX_CODEPOINT, BLOCK):
+        block = tuple(index[value] for value in classes[start:start + BLOCK])
+        if block not in block_of:
+            block_of[block] = len(blocks)
+            blocks.append(block)
+        stage1.append(block_of[block])
+
+    print("const Uint16 %s_blocks[UNICODE_BLOCKS] = {" % name)
+    for i in range(0, len(stage1), 16):
+        print("    " + ", ".join("%d" % b for b in stage1[i:i + 16]) + ",")
+    print("};\n")
+    print("const Uint8 %s_classes[%d][UNICODE_BLOCK_SIZE] = {" % (name, len(blocks)))
+    for block in blocks:
+        print("    {")
+        for i in range(0, BLOCK, 32):
+            print("        " + ",".join("%d" % v for v in block[i:i + 32]) + ",")
+        print("    },")
+    print("};\n")
+
+
+UCD_FILES = ["LineBreak.txt", "GraphemeBreakProperty.txt", "UnicodeData.txt", "emoji-data.txt"]
+
+
+def ucd_version(ucd_dir):
+    """Release of the versioned files, from their first line such as # LineBreak-15.1.0.txt"""
+    versions = set()
+    for name in ("LineBreak.txt", "GraphemeBreakProperty.txt"):
+        with open(os.path.join(ucd_dir, name), encoding="utf-8") as ucd:
+            first = ucd.readline().strip()
+        stem = name[:-len(".txt")] + "-"
+        if not first.startswith("# " + stem) or not first.endswith(".txt"):
+            sys.exit("%s: no version in its first line" % name)
+        versions.add(first[len("# " + stem):-len(".txt")])
+    if len(versions) != 1:
+        sys.exit("The UCD files are from different releases: %s" % ", ".join(sorted(versions)))
+    return versions.pop()
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: gen_unicode_tables.py ucd_dir [version] > src/unicode_tables.c")
+    ucd_dir = sys.argv[1]
+    missing = [name for name in UCD_FILES if not os.path.isfile(os.path.join(ucd_dir, name))]
+    if missing:
+        sys.exit("Missing in %s: %s" % (ucd_dir, ", ".join(missing)))
+    version = ucd_version(ucd_dir)
+    if len(sys.argv) > 2 and sys.argv[2] != version:
+        sys.exit("The UCD files are version %s, not %s" % (version, sys.argv[2]))
+
+    line_breaks = line_breaks_from_ucd(ucd_dir)
+    graphemes = graphemes_from_ucd(ucd_dir)
+    source = "the Unicode Character Database %s" % version
+
+    print("/* unicode_tables.c */")
+    print("/* Generated by tools/gen_unicode_tables.py from %s, do not edit */" % source)
+    print('#include "unicode_tables.h"\n')
+    emit_table("line_break", line_breaks, LINE_BREAK_CLASSES)
+    emit_table("grapheme_break", graphemes, GRAPHEME_CLASSES)
+
+
+if __name__ == "__main__":
+    main()